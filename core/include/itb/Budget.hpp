@@ -0,0 +1,31 @@
+#pragma once
+
+#include <itb/ImageCache.hpp>
+#include <itb/Pipeline.hpp>
+
+#include <cstddef>
+#include <optional>
+
+namespace itb {
+    // Largest tolerance the budget solver will trade quality for.
+    constexpr int kMaxBudgetTolerance = 32;
+
+    struct BudgetResult {
+        // `base` with step, tolerance and strategy replaced.
+        ImportSettings settings;
+        // Blocks and RMS colour error the solver measured for them.
+        size_t objects = 0;
+        double error = 0.0;
+    };
+
+    // Finds the settings that import `image` with the finest step that fits in `targetObjects`
+    // blocks, and at that step the tolerance and strategy with the lowest colour error. Every other
+    // field of `base` is kept; without merging only the step is searched.
+    //
+    // Candidates are merged on grids box-filtered (or point-sampled) from one decode of the image,
+    // walking from the coarsest step that trivially fits towards finer ones and bisecting, so each
+    // probe costs about as much as a merge of the answer. Images over 4M pixels are decoded at a
+    // coarser base step first and only steps that are multiples of it are tried.
+    // Returns nullopt if the image cannot be decoded or the target is 0.
+    std::optional<BudgetResult> solveObjectBudget(ImageHandle& image, ImportSettings const& base, size_t targetObjects);
+}
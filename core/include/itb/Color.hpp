@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+namespace itb {
+    // How two cell colours are compared against the merge tolerance.
+    enum class ColorMetric { RGB, DeltaE76, DeltaE2000 };
+
+    struct Lab { float l, a, b; };
+
+    // CIELAB (D65) of a packed sRGB cell, trilinearly interpolated from a 33^3 table built once at
+    // first use, so no per-cell pow or cbrt.
+    Lab rgbToLab(uint32_t cell);
+    // Exact conversion the table is built from.
+    Lab rgbToLabExact(uint8_t r, uint8_t g, uint8_t b);
+
+    float deltaE76(Lab const& x, Lab const& y);
+    float deltaE2000(Lab const& x, Lab const& y);
+
+    char const* colorMetricName(ColorMetric metric);
+}
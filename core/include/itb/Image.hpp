@@ -0,0 +1,36 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace itb {
+    // Decoded image, always expanded to 8-bit RGBA in row-major order.
+    struct Image {
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> pixels;
+    };
+
+    struct SampleGrid;
+    enum class SampleMode;
+
+    struct ImageInfo {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        int bitDepth = 8;
+    };
+
+    std::optional<std::vector<unsigned char>> readFile(std::filesystem::path const& path);
+    std::optional<ImageInfo> probeImage(std::span<const unsigned char> data);
+    // Reads only as much of the file as the header needs, so it costs the same for any image size.
+    std::optional<ImageInfo> probeImageFile(std::filesystem::path const& path);
+    std::optional<Image> decodeImage(std::span<const unsigned char> data);
+
+    // Same grid as sampleGrid / averageGrid on decodeImage(data). PNGs are streamed row by row, so
+    // peak memory follows the grid size instead of the full image. Baseline JPEGs are decoded at
+    // 1/2, 1/4 or 1/8 size with a reduced IDCT, which already averages each block.
+    std::optional<SampleGrid> decodeSampled(std::span<const unsigned char> data, int step, SampleMode mode);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <itb/Image.hpp>
+#include <itb/IntegralImage.hpp>
+#include <itb/SampleGrid.hpp>
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace itb {
+    // Shared view of one image file. Each grid is read and decoded at most once while it stays cached,
+    // no matter how many callers (settings popup, import worker) ask for it. The file's bytes are
+    // dropped as soon as a decode has used them: grids decoded straight from the file (streamed PNG,
+    // reduced JPEG) never hold the full image, so a grid at a new step reads and decodes the file
+    // again. Recently used grids stay cached up to kCacheBytes, so stepping back to one skips that.
+    class ImageHandle {
+    public:
+        ImageHandle(std::filesystem::path path, std::filesystem::file_time_type mtime);
+
+        std::filesystem::path const& getPath() const { return m_path; }
+        std::filesystem::file_time_type getModifiedTime() const { return m_mtime; }
+
+        // Raw file contents, or null if the file could not be read. Kept for the next decode only.
+        std::shared_ptr<const std::vector<unsigned char>> getBytes();
+        // Header-only probe; does not pull the whole file into memory.
+        std::optional<ImageInfo> getInfo();
+        // Fully decoded RGBA pixels, or null if decoding failed.
+        std::shared_ptr<const Image> getImage();
+        // Packed grid of every `step`-th pixel (see decodeSampled). Reuses the full decode if one
+        // already exists; otherwise decodes straight from the file without keeping the image.
+        std::shared_ptr<const SampleGrid> getSampleGrid(int step, SampleMode mode);
+        // Summed-area tables of the same grid, built on first use and kept alongside it so merges
+        // that only change tolerance skip both the decode and the table build.
+        std::shared_ptr<const IntegralImage> getIntegralImage(int step, SampleMode mode);
+
+        // Bytes of grids and tables kept for the most recently used (step, mode) pairs. Tables cost
+        // seven times their grid, so a step-1 4K grid with tables fills this on its own; the most
+        // recent entry is always kept, whatever its size.
+        static constexpr size_t kCacheBytes = size_t(128) << 20;
+
+    private:
+        struct GridEntry {
+            int step;
+            SampleMode mode;
+            std::shared_ptr<const SampleGrid> grid;
+            std::shared_ptr<const IntegralImage> integral;
+        };
+
+        std::filesystem::path m_path;
+        std::filesystem::file_time_type m_mtime;
+
+        std::mutex m_mutex;
+        bool m_decodeAttempted = false;
+        std::shared_ptr<const std::vector<unsigned char>> m_bytes;
+        std::optional<ImageInfo> m_info;
+        std::shared_ptr<const Image> m_image;
+        // Most recently used first.
+        std::vector<GridEntry> m_grids;
+
+        // The cached entry for (step, mode), moved to the front, or null if decoding failed.
+        GridEntry* loadGridLocked(int step, SampleMode mode);
+        // Drops the least recently used entries past the first while the cache exceeds kCacheBytes.
+        void trimGridsLocked();
+
+        std::shared_ptr<const std::vector<unsigned char>> loadBytesLocked();
+        // The file's bytes for a decode, read again if an earlier decode already dropped them.
+        std::shared_ptr<const std::vector<unsigned char>> takeBytesLocked();
+    };
+
+    // Returns the live handle for `path` if one exists and the file has not changed on disk
+    // since, otherwise a fresh one. Handles are only kept alive by their users.
+    std::shared_ptr<ImageHandle> openImage(std::filesystem::path const& path);
+}
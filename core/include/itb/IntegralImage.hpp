@@ -0,0 +1,54 @@
+#pragma once
+
+#include <itb/SampleGrid.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace itb {
+    struct RegionStats {
+        int area = 0;
+        // Cells at or above the integral image's alpha threshold.
+        int opaque = 0;
+        // r, g, b, a
+        uint64_t sum[4] = {};
+        // r^2 + g^2 + b^2
+        uint64_t sumSquares = 0;
+
+        bool isOpaque() const { return opaque == area; }
+        float mean(int channel) const { return area ? float(sum[channel]) / area : 0.0f; }
+        // Mean squared RGB distance of the cells from the region's mean colour.
+        double variance() const;
+        // True when every cell has exactly the same RGB.
+        bool isUniform() const;
+        // Rounded per-channel mean, alpha included, packed like a cell.
+        uint32_t meanColor() const;
+    };
+
+    // Summed-area tables over a sample grid: per-channel sums including alpha, summed squared RGB
+    // and opaque-cell counts, so the stats of any rectangle cost four lookups per table. Built once
+    // per grid and reusable across merges that only change tolerance.
+    class IntegralImage {
+    public:
+        IntegralImage() = default;
+        explicit IntegralImage(SampleGrid const& grid, int alphaThreshold = 200);
+
+        int getWidth() const { return m_width; }
+        int getHeight() const { return m_height; }
+        // Bytes held by the tables, 28 per (width + 1) x (height + 1) entry.
+        size_t getByteSize() const;
+
+        // Stats of the cells in [x, x + w) x [y, y + h).
+        RegionStats query(int x, int y, int w, int h) const;
+
+    private:
+        int m_width = 0;
+        int m_height = 0;
+        // (width + 1) x (height + 1) tables with a zero top row and left column. Channel sums and
+        // counts use wrapping 32-bit arithmetic, which stays exact for any rectangle whose true
+        // sum fits in 32 bits (every rectangle under 16M cells).
+        std::vector<uint32_t> m_sums[4];
+        std::vector<uint32_t> m_opaque;
+        std::vector<uint64_t> m_squares;
+    };
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <itb/Color.hpp>
+#include <itb/IntegralImage.hpp>
+#include <itb/Parallel.hpp>
+#include <itb/SampleGrid.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace itb {
+    enum class MergeMode { Greedy, LargestFirst, Quadtree, ErrorBudget, Components };
+
+    // One block in grid cells and the packed colour to paint it. Blocks of a layered merge overlap,
+    // and higher `z` is drawn on top.
+    struct MergeRect {
+        int x, y;
+        int spanX, spanY;
+        uint32_t color;
+        int z = 0;
+    };
+
+    struct MergeParams {
+        // Per-channel colour tolerance. Quadtree and ErrorBudget keep a block's RMS error around its
+        // mean colour, taken over every cell and each of R, G and B, within it: the summed variance
+        // of the three channels is at most 3 * tolerance^2.
+        int tolerance = 5;
+        // Longest block edge in cells; 1 emits every cell on its own.
+        int maxSpan = 20;
+        // Distance Greedy, LargestFirst and Components compare against `tolerance`; ΔE metrics read it
+        // in ΔE units.
+        ColorMetric metric = ColorMetric::RGB;
+        // Polled between rows and sweeps. A cancelled merge stops early and returns a partial cover
+        // the caller must throw away.
+        CancelToken cancel = {};
+    };
+
+    // Covers every opaque cell (alpha >= 200) of a grid with non-overlapping blocks.
+    class MergeStrategy {
+    public:
+        virtual ~MergeStrategy() = default;
+
+        virtual MergeMode getMode() const = 0;
+        virtual std::vector<MergeRect> merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const = 0;
+        // Whether merge reads `integral` for this grid; when it doesn't, callers may pass an empty
+        // IntegralImage instead of building one.
+        virtual bool usesIntegral(SampleGrid const&) const { return true; }
+    };
+
+    std::unique_ptr<MergeStrategy> createMergeStrategy(MergeMode mode);
+    char const* mergeModeName(MergeMode mode);
+
+    // Painter's decomposition: the cells of up to `layers` common colours are each painted as blocks
+    // that may run under the cells of colours drawn after them, a layer per colour, then `detail`
+    // merges the remaining cells on top. Layers are only kept while they cut the block count, so
+    // this never returns more blocks than `detail` alone. Blocks come in drawing order.
+    std::vector<MergeRect> mergeLayered(MergeStrategy const& detail, SampleGrid const& grid, IntegralImage const& integral,
+        MergeParams const& params, int layers);
+
+    // RMS per-channel difference between each covered cell and the colour drawn on top of it.
+    double measureMergeError(SampleGrid const& grid, std::vector<MergeRect> const& rects);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+namespace itb {
+    // Worker threads the parallel stages may use. Defaults to the hardware concurrency.
+    int getThreadCount();
+    // 0 restores the hardware default.
+    void setThreadCount(int count);
+
+    // Runs body(begin, end) over contiguous slices of [0, count), each at least `grain` long, on up
+    // to getThreadCount() threads. The calling thread runs the first slice; the rest go to a worker
+    // pool shared by every call, started on first use, and the caller helps run queued slices until
+    // its own are done. Nested calls are safe.
+    void parallelFor(int count, std::function<void(int begin, int end)> const& body, int grain = 1);
+
+    // Lets another thread call off long work: cancelled() turns true once `counter` stops holding
+    // `value`, such as an edit generation that moved on. The default token never cancels.
+    struct CancelToken {
+        std::atomic<int> const* counter = nullptr;
+        int value = 0;
+
+        bool cancelled() const { return counter && counter->load(std::memory_order_relaxed) != value; }
+    };
+}
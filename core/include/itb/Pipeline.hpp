@@ -0,0 +1,96 @@
+#pragma once
+
+#include <itb/Image.hpp>
+#include <itb/ImageCache.hpp>
+#include <itb/IntegralImage.hpp>
+#include <itb/Merge.hpp>
+#include <itb/Quantize.hpp>
+#include <itb/SampleGrid.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace itb {
+    struct Color3 { uint8_t r, g, b; };
+    struct GDHSV { float h, s, v; };
+
+    struct BlockData {
+        float x, y;
+        int spanX, spanY;
+        float visualScale;
+        GDHSV hsv;
+        Color3 color;
+        // Z order in the editor; only layered merges raise it above 0.
+        int zOrder = 0;
+    };
+
+    // Upper end of the editor's object scale control. A merged block is drawn by scaling one object
+    // to visualScale * span, so this bounds how many cells a block may span.
+    constexpr float kMaxObjectScale = 2.0f;
+
+    // Background layers a layered import tries; past a few colours each one saves little.
+    constexpr int kDefaultLayers = 3;
+
+    struct ImportSettings {
+        int step = 1;
+        float visualScale = 0.1f;
+        int tolerance = 5;
+        bool merge = true;
+        MergeMode strategy = MergeMode::Greedy;
+        ColorMetric metric = ColorMetric::RGB;
+        // Palette size for quantizeGrid before merging (1 to kMaxPaletteSize); 0 keeps every colour.
+        int paletteSize = 0;
+        DitherMode dither = DitherMode::None;
+        // Longest block edge in cells; 0 derives it from visualScale (see calculateMaxSpan).
+        int maxSpan = 0;
+        SampleMode sampling = SampleMode::Average;
+        // Common colours painted as overlapping background layers under `strategy` (see mergeLayered);
+        // 0 keeps every block disjoint.
+        int layers = 0;
+
+        bool operator==(ImportSettings const&) const = default;
+    };
+
+    GDHSV rgbToGdhsv(Color3 color);
+
+    // Most cells one block can span before its object scale would pass `maxObjectScale`.
+    int calculateMaxSpan(float visualScale, float maxObjectScale = kMaxObjectScale);
+
+    // Objects an import can add before the editor's frame rate suffers.
+    constexpr int kSafeObjectCount = 10000;
+
+    // Smallest step that keeps the raw grid at or below kSafeObjectCount cells.
+    int calculateSafeStep(int w, int h);
+
+    // Tolerance and span cap a merge with these settings runs with.
+    MergeParams getMergeParams(ImportSettings const& settings);
+
+    // Whether merging `grid` with `settings.strategy` reads its summed-area tables. Callers that
+    // don't need them pass an empty IntegralImage rather than building (or caching) one.
+    bool mergeUsesIntegral(SampleGrid const& grid, ImportSettings const& settings);
+
+    // Blocks `settings.strategy` covers the grid with, layered if `settings.layers` is set. The cover
+    // is partial if `cancel` fires (see MergeParams::cancel).
+    std::vector<MergeRect> mergeGrid(SampleGrid const& grid, IntegralImage const& integral, ImportSettings const& settings,
+        CancelToken cancel = {});
+
+    // Merges similar grid cells into blocks with `settings.strategy`. `settings.step` is ignored,
+    // the grid is already sampled. Block positions are relative to the centre of the grid.
+    std::vector<BlockData> buildBlocks(SampleGrid const& grid, ImportSettings const& settings);
+    // Same, reusing summed-area tables already built for `grid`.
+    std::vector<BlockData> buildBlocks(SampleGrid const& grid, IntegralImage const& integral, ImportSettings const& settings);
+
+    // Full import: decodes only the sampled pixels of `image`, quantizes them if a palette size is
+    // set, then builds blocks from them.
+    // Returns nullopt if the image cannot be decoded.
+    std::optional<std::vector<BlockData>> importImage(ImageHandle& image, ImportSettings const& settings);
+    // Number of blocks importImage would return, without building them. Grids and tables come from
+    // the handle's cache, so counts that only change tolerance or strategy skip the decode.
+    // Returns nullopt if the image cannot be decoded or `cancel` fires before the count is known.
+    std::optional<size_t> countImportBlocks(ImageHandle& image, ImportSettings const& settings, CancelToken cancel = {});
+
+    // Serialises blocks as a level object string, offset by the given editor-space origin.
+    std::string buildLevelString(std::vector<BlockData> const& blocks, float originX, float originY);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <itb/ImageCache.hpp>
+#include <itb/Pipeline.hpp>
+
+#include <optional>
+#include <vector>
+
+namespace itb {
+    // Blocks merged for a preview, in cells of the grid they were merged on.
+    struct PreviewMerge {
+        int width = 0;
+        int height = 0;
+        // Import cells per preview cell along each side; 1 when the import's own grid was merged.
+        int factor = 1;
+        std::vector<MergeRect> rects;
+    };
+
+    // Merges `image` as `settings` would import it, for a preview at most `maxSize` cells on a side.
+    // When the import grid is larger, it is downscaled by a whole factor (point or box filtered to
+    // match `settings.sampling`) and merged with the span cap divided by the same factor, so blocks
+    // keep roughly their size. The import grid comes from the handle's cache.
+    // Returns nullopt if the image cannot be decoded or `cancel` fires before the merge is done.
+    std::optional<PreviewMerge> mergePreview(ImageHandle& image, ImportSettings const& settings, int maxSize,
+        CancelToken cancel = {});
+
+    // Draws the blocks in their colours, opaque, on a transparent image of the largest whole number of
+    // pixels per cell that fits in `maxSize`, in drawing order. With `outlines`, the edge pixels of
+    // every block are darkened.
+    Image renderPreview(PreviewMerge const& merge, int maxSize, bool outlines);
+}
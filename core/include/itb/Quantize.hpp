@@ -0,0 +1,19 @@
+#pragma once
+
+#include <itb/SampleGrid.hpp>
+
+namespace itb {
+    enum class DitherMode { None, Bayer, BlueNoise, FloydSteinberg };
+
+    // Largest palette quantizeGrid builds; larger requests are clamped to it.
+    constexpr int kMaxPaletteSize = 256;
+
+    // Reduces the opaque cells (alpha >= 200) of `grid` to at most `colors` (1 to kMaxPaletteSize)
+    // colours by median cut over a 5-bit-per-channel histogram, painting each with the mean of its
+    // box. Other cells and every cell's alpha are left as they are. Histograms are built per thread and then summed.
+    // With dithering, cells map to their nearest palette colour after an ordered threshold offset
+    // (Bayer 8x8 or 32x32 blue noise) or with Floyd-Steinberg error diffusion.
+    SampleGrid quantizeGrid(SampleGrid const& grid, int colors, DitherMode dither = DitherMode::None);
+
+    char const* ditherModeName(DitherMode mode);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <itb/Image.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace itb {
+    enum class SampleMode {
+        // Top-left pixel of each step x step block.
+        Point,
+        // Mean of the whole block: alpha-weighted colour, plain alpha.
+        Average,
+    };
+
+    // One RGBA sample per grid cell, packed as r | g << 8 | b << 16 | a << 24 in row-major order.
+    // This is all the merge engine reads; the decoded image can be dropped once it exists.
+    struct SampleGrid {
+        int width = 0;
+        int height = 0;
+        std::vector<uint32_t> cells;
+
+        uint32_t at(int x, int y) const { return cells[(size_t)y * width + x]; }
+    };
+
+    constexpr uint32_t packRGBA(uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+    constexpr int cellRed(uint32_t cell) { return cell & 0xff; }
+    constexpr int cellGreen(uint32_t cell) { return (cell >> 8) & 0xff; }
+    constexpr int cellBlue(uint32_t cell) { return (cell >> 16) & 0xff; }
+    constexpr int cellAlpha(uint32_t cell) { return cell >> 24; }
+
+    // Takes the pixel at (gx * step, gy * step) for every cell of a ceil(w/step) x ceil(h/step) grid.
+    SampleGrid sampleGrid(Image const& image, int step);
+    // Same grid for a width x height original when only a 1/scale copy of it was decoded: each cell
+    // takes the reduced pixel whose footprint covers its sample point.
+    SampleGrid sampleGridReduced(Image const& reduced, int width, int height, int step, int scale);
+
+    // Box-filtered grid of the same size as sampleGrid. Row bands run in parallel.
+    SampleGrid averageGrid(Image const& image, int step);
+
+    // The cells of `grid` as RGBA pixels, so the samplers above can downscale a grid again.
+    Image gridToImage(SampleGrid const& grid);
+}
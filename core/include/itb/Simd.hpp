@@ -0,0 +1,12 @@
+#pragma once
+
+namespace itb {
+    enum class SimdLevel { Scalar, SSE2, AVX2, NEON };
+
+    // Best instruction set this CPU supports, unless lowered with setSimdLevel.
+    SimdLevel getSimdLevel();
+    // Forces kernels down to `level` (clamped to what the CPU supports), mainly for benchmarking.
+    void setSimdLevel(SimdLevel level);
+    SimdLevel getMaxSimdLevel();
+    char const* simdLevelName(SimdLevel level);
+}
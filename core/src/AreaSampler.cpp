@@ -0,0 +1,142 @@
+#include "AreaSampler.hpp"
+
+#include "SimdTargets.hpp"
+
+#include <itb/SampleGrid.hpp>
+#include <itb/Simd.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace itb {
+    namespace {
+        void accumulateScalar(unsigned char const* p, uint32_t* sums, int width) {
+            for (int x = 0; x < width; x++, p += 4, sums += 4) {
+                uint32_t a = p[3];
+                sums[0] += p[0] * a;
+                sums[1] += p[1] * a;
+                sums[2] += p[2] * a;
+                sums[3] += a;
+            }
+        }
+
+#if ITB_X86
+        // Two pixels per 8 x u16 register: broadcast each pixel's alpha over its own lanes, keep 1 in
+        // the alpha lane, and one mullo gives r*a, g*a, b*a, a (all below 2^16).
+        void accumulateSse2(unsigned char const* p, uint32_t* sums, int width) {
+            __m128i const zero = _mm_setzero_si128();
+            __m128i const rgbMask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+            __m128i const alphaOne = _mm_set_epi16(1, 0, 0, 0, 1, 0, 0, 0);
+
+            int x = 0;
+            for (; x + 4 <= width; x += 4) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + x * 4));
+                __m128i halves[2] = { _mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero) };
+                for (int h = 0; h < 2; h++) {
+                    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves[h], 0xFF), 0xFF);
+                    __m128i weight = _mm_or_si128(_mm_and_si128(alpha, rgbMask), alphaOne);
+                    __m128i product = _mm_mullo_epi16(halves[h], weight);
+
+                    auto* s = reinterpret_cast<__m128i*>(sums + (x + h * 2) * 4);
+                    _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_unpacklo_epi16(product, zero)));
+                    _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(product, zero)));
+                }
+            }
+            accumulateScalar(p + x * 4, sums + x * 4, width - x);
+        }
+
+        ITB_TARGET_AVX2 void accumulateAvx2(unsigned char const* p, uint32_t* sums, int width) {
+            __m256i const rgbMask = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1);
+            __m256i const alphaOne = _mm256_set_epi16(1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0);
+
+            int x = 0;
+            for (; x + 4 <= width; x += 4) {
+                __m256i pixels = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const*>(p + x * 4)));
+                __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, 0xFF), 0xFF);
+                __m256i weight = _mm256_or_si256(_mm256_and_si256(alpha, rgbMask), alphaOne);
+                __m256i product = _mm256_mullo_epi16(pixels, weight);
+
+                auto* s = reinterpret_cast<__m256i*>(sums + x * 4);
+                __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(product));
+                __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(product, 1));
+                _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s), lo));
+                _mm256_storeu_si256(s + 1, _mm256_add_epi32(_mm256_loadu_si256(s + 1), hi));
+            }
+            accumulateScalar(p + x * 4, sums + x * 4, width - x);
+        }
+#endif
+
+#if ITB_NEON
+        // vld4 splits eight pixels into planes, so the weights are plain widening multiplies;
+        // vld4q/vst4q on the sums keep them interleaved like the other kernels.
+        void accumulateNeon(unsigned char const* p, uint32_t* sums, int width) {
+            int x = 0;
+            for (; x + 8 <= width; x += 8) {
+                uint8x8x4_t px = vld4_u8(p + x * 4);
+                uint16x8_t weighted[4] = {
+                    vmull_u8(px.val[0], px.val[3]),
+                    vmull_u8(px.val[1], px.val[3]),
+                    vmull_u8(px.val[2], px.val[3]),
+                    vmovl_u8(px.val[3]),
+                };
+
+                uint32x4x4_t lo = vld4q_u32(sums + x * 4);
+                uint32x4x4_t hi = vld4q_u32(sums + x * 4 + 16);
+                for (int c = 0; c < 4; c++) {
+                    lo.val[c] = vaddw_u16(lo.val[c], vget_low_u16(weighted[c]));
+                    hi.val[c] = vaddw_u16(hi.val[c], vget_high_u16(weighted[c]));
+                }
+                vst4q_u32(sums + x * 4, lo);
+                vst4q_u32(sums + x * 4 + 16, hi);
+            }
+            accumulateScalar(p + x * 4, sums + x * 4, width - x);
+        }
+#endif
+    }
+
+    AreaAccumulator::AreaAccumulator(int width, int step)
+        : m_width(width), m_step(std::max(1, step)), m_sums((size_t)width * 4, 0), m_kernel(accumulateScalar) {
+        switch (getSimdLevel()) {
+#if ITB_X86
+            case SimdLevel::AVX2: m_kernel = accumulateAvx2; break;
+            case SimdLevel::SSE2: m_kernel = accumulateSse2; break;
+#endif
+#if ITB_NEON
+            case SimdLevel::NEON: m_kernel = accumulateNeon; break;
+#endif
+            default: break;
+        }
+    }
+
+    void AreaAccumulator::addRow(unsigned char const* rgba) {
+        m_kernel(rgba, m_sums.data(), m_width);
+        m_rows++;
+    }
+
+    void AreaAccumulator::finish(uint32_t* out) {
+        int cells = (m_width + m_step - 1) / m_step;
+        for (int gx = 0; gx < cells; gx++) {
+            int x0 = gx * m_step, x1 = std::min(m_width, x0 + m_step);
+            uint64_t total[4] = {};
+            for (int x = x0; x < x1; x++) {
+                for (int c = 0; c < 4; c++) total[c] += m_sums[(size_t)x * 4 + c];
+            }
+
+            uint64_t count = (uint64_t)(x1 - x0) * std::max(1, m_rows);
+            uint64_t weight = total[3];
+            uint32_t alpha = (uint32_t)((weight + count / 2) / count);
+            if (!weight) {
+                out[gx] = 0;
+                continue;
+            }
+            out[gx] = packRGBA(
+                (uint32_t)((total[0] + weight / 2) / weight),
+                (uint32_t)((total[1] + weight / 2) / weight),
+                (uint32_t)((total[2] + weight / 2) / weight),
+                alpha
+            );
+        }
+        std::memset(m_sums.data(), 0, m_sums.size() * sizeof(uint32_t));
+        m_rows = 0;
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace itb {
+    // Box-filter accumulator for one grid row. Image rows are added column by column with the
+    // widest SIMD kernel available; finish() then folds each step-wide group of columns into one
+    // cell whose colour is the alpha-weighted mean and whose alpha is the plain mean.
+    class AreaAccumulator {
+    public:
+        AreaAccumulator(int width, int step);
+
+        void addRow(unsigned char const* rgba);
+        // Writes ceil(width / step) cells and clears the accumulator for the next grid row.
+        void finish(uint32_t* out);
+
+    private:
+        using Kernel = void (*)(unsigned char const* rgba, uint32_t* sums, int width);
+
+        int m_width;
+        int m_step;
+        int m_rows = 0;
+        // Per pixel column: r*a, g*a, b*a, a.
+        std::vector<uint32_t> m_sums;
+        Kernel m_kernel;
+    };
+}
@@ -0,0 +1,231 @@
+#include <itb/Budget.hpp>
+
+#include <itb/Quantize.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace itb {
+    namespace {
+        // Most pixels decoded for the pyramid's base level.
+        constexpr long long kBaseCells = 4'000'000;
+        // Most cells of the finest level merged for every candidate; finer steps are extrapolated.
+        constexpr long long kProbeCells = 1 << 16;
+
+        constexpr int kTolerances[] = { 0, 3, 6, 10, 16, 24, kMaxBudgetTolerance };
+        // LargestFirst is left out: Components runs the same rectangle search per region and paints
+        // blocks with their mean, which measures lower error at about the same count and time.
+        constexpr MergeMode kSearchModes[] = { MergeMode::Greedy, MergeMode::Quadtree, MergeMode::ErrorBudget, MergeMode::Components };
+
+        struct Level {
+            // Sampled cells, which merge errors are measured against.
+            SampleGrid grid;
+            // The cells merges run on: `grid`, quantized when a palette is set.
+            SampleGrid merged;
+            IntegralImage integral;
+
+            Level(SampleGrid sampled, ImportSettings const& settings)
+                : grid(std::move(sampled)),
+                  merged(settings.paletteSize > 0 ? quantizeGrid(grid, settings.paletteSize, settings.dither) : grid),
+                  integral(merged) {}
+        };
+
+        struct Probe {
+            size_t objects;
+            // RMS error of the merge against its own level's grid.
+            double error;
+        };
+
+        // Grids at every multiple of the base step, derived from the base level on first use, and
+        // the merges run on them.
+        class BudgetSearch {
+        public:
+            BudgetSearch(SampleGrid const& base, IntegralImage const& integral, ImportSettings const& settings)
+                : m_base(gridToImage(base)), m_integral(integral), m_settings(settings) {}
+
+            long long getCells(int factor) const {
+                return (long long)((m_base.width + factor - 1) / factor) * ((m_base.height + factor - 1) / factor);
+            }
+
+            ImportSettings settingsFor(int factor, MergeMode mode, int tolerance) const {
+                ImportSettings settings = m_settings;
+                settings.step *= factor;
+                settings.strategy = mode;
+                settings.tolerance = tolerance;
+                return settings;
+            }
+
+            Probe const& probe(int factor, MergeMode mode, int tolerance) {
+                auto [it, added] = m_probes.try_emplace({ factor, int(mode), tolerance });
+                if (added) {
+                    auto const& level = this->level(factor);
+                    auto rects = mergeGrid(level.merged, level.integral, this->settingsFor(factor, mode, tolerance));
+                    it->second = { rects.size(), measureMergeError(level.grid, rects) };
+                }
+                return it->second;
+            }
+
+            // RMS error of the base cells against the cell that stands for them at `factor`, before
+            // merging: their variance around the block mean when averaging, or around the block's first
+            // cell when point sampling. Blocks with transparent cells are left out.
+            double resolutionError(int factor) {
+                if (factor == 1) return 0.0;
+                auto [it, added] = m_resolutionErrors.try_emplace(factor);
+                if (!added) return it->second;
+
+                double total = 0.0;
+                long long count = 0;
+                for (int y = 0; y < m_base.height; y += factor) {
+                    for (int x = 0; x < m_base.width; x += factor) {
+                        auto stats = m_integral.query(x, y, std::min(factor, m_base.width - x), std::min(factor, m_base.height - y));
+                        if (!stats.isOpaque()) continue;
+                        double error = stats.variance() * stats.area;
+                        if (m_settings.sampling == SampleMode::Point) {
+                            unsigned char const* first = &m_base.pixels[(size_t(y) * m_base.width + x) * 4];
+                            for (int c = 0; c < 3; c++) {
+                                double offset = stats.mean(c) - first[c];
+                                error += offset * offset * stats.area;
+                            }
+                        }
+                        total += error;
+                        count += stats.area;
+                    }
+                }
+                return it->second = count ? std::sqrt(total / (3.0 * count)) : 0.0;
+            }
+
+        private:
+            SampleGrid sample(int factor) const {
+                return m_settings.sampling == SampleMode::Average ? averageGrid(m_base, factor) : sampleGrid(m_base, factor);
+            }
+
+            Level const& level(int factor) {
+                auto& level = m_levels[factor];
+                if (!level) level = std::make_unique<Level>(this->sample(factor), m_settings);
+                return *level;
+            }
+
+            Image m_base;
+            IntegralImage const& m_integral;
+            ImportSettings m_settings;
+            std::map<int, std::unique_ptr<Level>> m_levels;
+            std::map<std::tuple<int, int, int>, Probe> m_probes;
+            std::map<int, double> m_resolutionErrors;
+        };
+
+        struct Candidate {
+            MergeMode mode;
+            int tolerance;
+            int factor;
+            double error;
+        };
+    }
+
+    std::optional<BudgetResult> solveObjectBudget(ImageHandle& image, ImportSettings const& base, size_t targetObjects) {
+        auto info = image.getInfo();
+        if (!info || targetObjects == 0) return std::nullopt;
+
+        long long pixels = (long long)info->width * info->height;
+        int baseStep = std::max(1, int(std::ceil(std::sqrt(double(pixels) / kBaseCells))));
+        auto baseGrid = image.getSampleGrid(baseStep, base.sampling);
+        auto baseIntegral = image.getIntegralImage(baseStep, base.sampling);
+        if (!baseGrid || !baseIntegral) return std::nullopt;
+        ImportSettings settings = base;
+        settings.step = baseStep;
+        BudgetSearch search(*baseGrid, *baseIntegral, settings);
+
+        long long target = (long long)std::min<size_t>(targetObjects, size_t(1) << 62);
+        // No merge emits more blocks than cells, so `trivial` always fits; `probeFactor` is the finest
+        // level merged directly.
+        int trivial = 1, probeFactor = 1;
+        while (search.getCells(trivial) > target) trivial++;
+        while (search.getCells(probeFactor) > kProbeCells) probeFactor++;
+
+        // Finest factor a mode and tolerance fit at. Counts are taken to grow as a power of the grid's
+        // resolution between 1 (only outlines add blocks) and 2 (every cell is one), fitted to the probe
+        // level and the level twice as coarse. Guesses at or above the probe level are cheap to settle
+        // with real merges; finer ones are checked once a candidate wins.
+        auto finestFit = [&](MergeMode mode, int tolerance) {
+            auto const& near = search.probe(probeFactor, mode, tolerance);
+            if (near.objects == 0) return 1;
+            auto const& far = search.probe(probeFactor * 2, mode, tolerance);
+            double exponent = far.objects ? std::clamp(std::log2(double(near.objects) / far.objects), 1.0, 2.0) : 2.0;
+            double guess = probeFactor * std::pow(double(near.objects) / target, 1.0 / exponent);
+            int factor = std::clamp(int(std::ceil(guess - 1e-9)), 1, trivial);
+            if (factor < probeFactor) return factor;
+            // Gallop away from the guess until the answer is bracketed, then bisect. `miss` is only
+            // assumed not to fit below the probe level, which isn't searched here.
+            auto fits = [&](int f) { return (long long)search.probe(f, mode, tolerance).objects <= target; };
+            int miss = probeFactor - 1, fit = trivial;
+            if (fits(factor)) {
+                fit = factor;
+                for (int stride = 1; fit - stride > miss; stride *= 2) {
+                    if (!fits(fit - stride)) {
+                        miss = fit - stride;
+                        break;
+                    }
+                    fit -= stride;
+                }
+            }
+            else {
+                miss = factor;
+                for (int stride = 1; miss + stride < trivial; stride *= 2) {
+                    if (fits(miss + stride)) {
+                        fit = miss + stride;
+                        break;
+                    }
+                    miss += stride;
+                }
+            }
+            while (fit - miss > 1) {
+                int mid = (miss + fit) / 2;
+                if (fits(mid)) fit = mid;
+                else miss = mid;
+            }
+            return fit;
+        };
+
+        // Quality is the RMS error against the base grid, split into what the step loses and what the
+        // merge loses on top of it; the latter is measured at the probe level for finer steps.
+        std::vector<MergeMode> modes(std::begin(kSearchModes), std::end(kSearchModes));
+        std::vector<int> tolerances(std::begin(kTolerances), std::end(kTolerances));
+        if (!base.merge) {
+            modes = { base.strategy };
+            tolerances = { base.tolerance };
+        }
+        std::vector<Candidate> candidates;
+        for (auto mode : modes) {
+            for (int tolerance : tolerances) {
+                int factor = finestFit(mode, tolerance);
+                double mergeError = search.probe(std::max(factor, probeFactor), mode, tolerance).error;
+                double resolutionError = search.resolutionError(factor);
+                candidates.push_back({ mode, tolerance, factor, std::sqrt(resolutionError * resolutionError + mergeError * mergeError) });
+            }
+        }
+        // Best first: an extrapolated candidate is merged for real and put back with its measured count
+        // and error, one step coarser if it doesn't fit, until the best one is a verified fit.
+        auto byError = [](Candidate const& a, Candidate const& b) {
+            return a.error < b.error || (a.error == b.error && a.factor < b.factor);
+        };
+        while (true) {
+            auto best = std::min_element(candidates.begin(), candidates.end(), byError);
+            auto const& probe = search.probe(best->factor, best->mode, best->tolerance);
+            double resolutionError = search.resolutionError(best->factor);
+            double error = std::sqrt(resolutionError * resolutionError + probe.error * probe.error);
+            bool fits = (long long)probe.objects <= target;
+            if (fits && (best->factor >= probeFactor || error <= best->error)) {
+                return BudgetResult { search.settingsFor(best->factor, best->mode, best->tolerance), probe.objects, error };
+            }
+            if (fits) best->error = error;
+            else {
+                best->factor++;
+                double coarser = search.resolutionError(best->factor);
+                double mergeError = search.probe(std::max(best->factor, probeFactor), best->mode, best->tolerance).error;
+                best->error = std::sqrt(coarser * coarser + mergeError * mergeError);
+            }
+        }
+    }
+}
@@ -0,0 +1,126 @@
+#include <itb/Color.hpp>
+#include <itb/SampleGrid.hpp>
+
+#include <cmath>
+#include <vector>
+
+namespace itb {
+    namespace {
+        constexpr int kNodes = 33;
+        constexpr float kPi = 3.14159265358979f;
+
+        float srgbToLinear(float c) {
+            return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+
+        float labCurve(float t) {
+            return t > 216.0f / 24389.0f ? std::cbrt(t) : (24389.0f / 27.0f * t + 16.0f) / 116.0f;
+        }
+
+        std::vector<Lab> const& labTable() {
+            static std::vector<Lab> const table = [] {
+                std::vector<Lab> nodes(kNodes * kNodes * kNodes);
+                for (int r = 0; r < kNodes; r++)
+                    for (int g = 0; g < kNodes; g++)
+                        for (int b = 0; b < kNodes; b++) {
+                            auto node = [](int i) { return uint8_t(i * 255 / (kNodes - 1)); };
+                            nodes[(r * kNodes + g) * kNodes + b] = rgbToLabExact(node(r), node(g), node(b));
+                        }
+                return nodes;
+            }();
+            return table;
+        }
+    }
+
+    Lab rgbToLabExact(uint8_t r8, uint8_t g8, uint8_t b8) {
+        float r = srgbToLinear(r8 / 255.0f), g = srgbToLinear(g8 / 255.0f), b = srgbToLinear(b8 / 255.0f);
+        float x = (0.4124564f * r + 0.3575761f * g + 0.1804375f * b) / 0.95047f;
+        float y = 0.2126729f * r + 0.7151522f * g + 0.0721750f * b;
+        float z = (0.0193339f * r + 0.1191920f * g + 0.9503041f * b) / 1.08883f;
+        float fx = labCurve(x), fy = labCurve(y), fz = labCurve(z);
+        return { 116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz) };
+    }
+
+    Lab rgbToLab(uint32_t cell) {
+        auto const& table = labTable();
+        // Node i sits at i * 255 / 32, so every 8-bit value lands in a cell at most 8 wide.
+        int index[3];
+        float frac[3];
+        for (int c = 0; c < 3; c++) {
+            float pos = float((cell >> (c * 8)) & 0xFF) * (kNodes - 1) / 255.0f;
+            index[c] = pos >= kNodes - 1 ? kNodes - 2 : int(pos);
+            frac[c] = pos - index[c];
+        }
+
+        Lab out{ 0, 0, 0 };
+        for (int corner = 0; corner < 8; corner++) {
+            int dr = corner >> 2, dg = (corner >> 1) & 1, db = corner & 1;
+            float weight = (dr ? frac[0] : 1 - frac[0]) * (dg ? frac[1] : 1 - frac[1]) * (db ? frac[2] : 1 - frac[2]);
+            Lab const& n = table[((index[0] + dr) * kNodes + index[1] + dg) * kNodes + index[2] + db];
+            out.l += weight * n.l;
+            out.a += weight * n.a;
+            out.b += weight * n.b;
+        }
+        return out;
+    }
+
+    float deltaE76(Lab const& x, Lab const& y) {
+        float dl = x.l - y.l, da = x.a - y.a, db = x.b - y.b;
+        return std::sqrt(dl * dl + da * da + db * db);
+    }
+
+    // CIEDE2000 as in Sharma, Wu and Dalal (2005), with kL = kC = kH = 1.
+    float deltaE2000(Lab const& x, Lab const& y) {
+        float c1 = std::sqrt(x.a * x.a + x.b * x.b), c2 = std::sqrt(y.a * y.a + y.b * y.b);
+        float cMean7 = std::pow((c1 + c2) / 2.0f, 7.0f);
+        float g = 0.5f * (1.0f - std::sqrt(cMean7 / (cMean7 + 6103515625.0f)));
+        float a1 = (1.0f + g) * x.a, a2 = (1.0f + g) * y.a;
+        float cp1 = std::sqrt(a1 * a1 + x.b * x.b), cp2 = std::sqrt(a2 * a2 + y.b * y.b);
+
+        auto hue = [](float b, float a) {
+            if (a == 0.0f && b == 0.0f) return 0.0f;
+            float h = std::atan2(b, a) * 180.0f / kPi;
+            return h < 0.0f ? h + 360.0f : h;
+        };
+        float hp1 = hue(x.b, a1), hp2 = hue(y.b, a2);
+
+        float dL = y.l - x.l, dC = cp2 - cp1;
+        float dh = 0.0f;
+        if (cp1 * cp2 != 0.0f) {
+            dh = hp2 - hp1;
+            if (dh > 180.0f) dh -= 360.0f;
+            else if (dh < -180.0f) dh += 360.0f;
+        }
+        float dH = 2.0f * std::sqrt(cp1 * cp2) * std::sin(dh * kPi / 360.0f);
+
+        float lMean = (x.l + y.l) / 2.0f, cpMean = (cp1 + cp2) / 2.0f;
+        float hMean = hp1 + hp2;
+        if (cp1 * cp2 != 0.0f) {
+            if (std::abs(hp1 - hp2) <= 180.0f) hMean /= 2.0f;
+            else hMean = hMean < 360.0f ? (hMean + 360.0f) / 2.0f : (hMean - 360.0f) / 2.0f;
+        }
+
+        auto rad = [](float deg) { return deg * kPi / 180.0f; };
+        float t = 1.0f - 0.17f * std::cos(rad(hMean - 30.0f)) + 0.24f * std::cos(rad(2.0f * hMean)) +
+            0.32f * std::cos(rad(3.0f * hMean + 6.0f)) - 0.20f * std::cos(rad(4.0f * hMean - 63.0f));
+        float dTheta = 30.0f * std::exp(-((hMean - 275.0f) / 25.0f) * ((hMean - 275.0f) / 25.0f));
+        float cpMean7 = std::pow(cpMean, 7.0f);
+        float rc = 2.0f * std::sqrt(cpMean7 / (cpMean7 + 6103515625.0f));
+        float l50 = (lMean - 50.0f) * (lMean - 50.0f);
+        float sl = 1.0f + 0.015f * l50 / std::sqrt(20.0f + l50);
+        float sc = 1.0f + 0.045f * cpMean;
+        float sh = 1.0f + 0.015f * cpMean * t;
+        float rt = -std::sin(rad(2.0f * dTheta)) * rc;
+
+        float tl = dL / sl, tc = dC / sc, th = dH / sh;
+        return std::sqrt(tl * tl + tc * tc + th * th + rt * tc * th);
+    }
+
+    char const* colorMetricName(ColorMetric metric) {
+        switch (metric) {
+            case ColorMetric::DeltaE76: return "dE76";
+            case ColorMetric::DeltaE2000: return "dE2000";
+            default: return "RGB";
+        }
+    }
+}
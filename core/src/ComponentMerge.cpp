@@ -0,0 +1,285 @@
+#include "MatchPolicy.hpp"
+#include "MergeStrategies.hpp"
+#include "RectCover.hpp"
+
+#include <itb/Parallel.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <unordered_set>
+
+namespace itb {
+    namespace {
+        // Rows per labelling band; bands are flood-filled in parallel and joined serially afterwards.
+        constexpr int kBandRows = 64;
+        // Components of at least this many cells whose bounding box is at most kMaxSparseness times
+        // their cell count are covered on their own; smaller ones aren't worth a cover's setup and
+        // sparser ones would make it sweep mostly other components' cells.
+        constexpr long long kMinOwnCells = 256;
+        constexpr long long kMaxSparseness = 4;
+
+        // A region flood-filled inside one band, and after stitching the union-find node of the set
+        // it belongs to. Seeds are the first cell in row-major order, so a set's root is the region
+        // with the smallest seed and its seed is the whole set's.
+        struct Region {
+            int seed;
+            // Per-channel minimum and maximum RGB of the set's cells, packed like cells.
+            uint32_t lo, hi;
+            // The region's cells in fill order within its band.
+            int begin, end;
+            int parent;
+            // Next region of the same set, or -1; the root keeps the list's tail in `last`.
+            int next, last;
+        };
+
+        struct Band {
+            std::vector<Region> regions;
+            std::vector<int> cells;
+        };
+
+        struct Component {
+            int x0, y0, x1, y1;
+            long long cells = 0;
+        };
+
+        uint32_t channelMin(uint32_t a, uint32_t b) {
+            return packRGBA(std::min(cellRed(a), cellRed(b)), std::min(cellGreen(a), cellGreen(b)), std::min(cellBlue(a), cellBlue(b)), 0);
+        }
+        uint32_t channelMax(uint32_t a, uint32_t b) {
+            return packRGBA(std::max(cellRed(a), cellRed(b)), std::max(cellGreen(a), cellGreen(b)), std::max(cellBlue(a), cellBlue(b)), 0);
+        }
+
+        int findRoot(std::vector<Region>& regions, int i) {
+            while (regions[i].parent != i) {
+                regions[i].parent = regions[regions[i].parent].parent;
+                i = regions[i].parent;
+            }
+            return i;
+        }
+
+        // Flood-fills the opaque cells of rows [y0, y1) into regions within tolerance of their seed,
+        // writing each cell's band-local region into `labels`.
+        template <class Policy>
+        void fillBand(SampleGrid const& grid, Policy const& policy, CancelToken const& cancel, int y0, int y1,
+            std::vector<int>& labels, Band& band) {
+            int gW = grid.width;
+            int first = y0 * gW, last = y1 * gW;
+            for (int start = first; start < last; start++) {
+                if (start % gW == 0 && cancel.cancelled()) return;
+                if (labels[start] >= 0 || cellAlpha(grid.cells[start]) < 200) continue;
+                int label = int(band.regions.size());
+                uint32_t seed = grid.cells[start];
+                Region region { start, seed, seed, int(band.cells.size()), 0, 0, -1, 0 };
+                labels[start] = label;
+                band.cells.push_back(start);
+
+                for (size_t head = region.begin; head < band.cells.size(); head++) {
+                    int idx = band.cells[head];
+                    int x = idx % gW;
+                    int neighbours[4] = { x > 0 ? idx - 1 : -1, x + 1 < gW ? idx + 1 : -1, idx - gW >= first ? idx - gW : -1, idx + gW < last ? idx + gW : -1 };
+                    for (int n : neighbours) {
+                        if (n < 0 || labels[n] >= 0) continue;
+                        if (!policy.matches(n, start)) continue;
+                        labels[n] = label;
+                        band.cells.push_back(n);
+                        region.lo = channelMin(region.lo, grid.cells[n]);
+                        region.hi = channelMax(region.hi, grid.cells[n]);
+                    }
+                }
+                region.end = int(band.cells.size());
+                band.regions.push_back(region);
+            }
+        }
+
+        // Labels 4-connected regions of opaque cells within tolerance of each region's first cell,
+        // like LargestFirstMerge, but as a parallel union-find: every 64-row band is flood-filled on
+        // its own, then sets meeting across a band edge are united whenever every cell of the later
+        // set still matches the earlier set's seed. Edges are walked in a fixed order, so labels
+        // don't depend on the thread count. Labels count up in seed order; transparent cells get -1.
+        // Returns each label's seed cell index.
+        template <class Policy>
+        std::vector<int> labelComponents(SampleGrid const& grid, Policy const& policy, CancelToken const& cancel, std::vector<int>& labels) {
+            int gW = grid.width, gH = grid.height;
+            int bandCount = (gH + kBandRows - 1) / kBandRows;
+            labels.assign(size_t(gW) * gH, -1);
+
+            std::vector<Band> bands(bandCount);
+            parallelFor(bandCount, [&](int begin, int end) {
+                for (int b = begin; b < end; b++)
+                    fillBand(grid, policy, cancel, b * kBandRows, std::min(gH, (b + 1) * kBandRows), labels, bands[b]);
+            });
+            if (cancel.cancelled()) return {};
+
+            // One global list of regions, band after band, so indices follow seed order.
+            std::vector<int> offsets(bandCount + 1, 0);
+            for (int b = 0; b < bandCount; b++) offsets[b + 1] = offsets[b] + int(bands[b].regions.size());
+            std::vector<Region> regions;
+            regions.reserve(offsets[bandCount]);
+            for (int b = 0; b < bandCount; b++) {
+                for (auto region : bands[b].regions) {
+                    region.parent = region.last = int(regions.size());
+                    regions.push_back(region);
+                }
+            }
+            auto regionAt = [&](int cell) { return offsets[cell / gW / kBandRows] + labels[cell]; };
+
+            // Metrics the bounding box can't settle test each cell; pairs that failed stay failed
+            // until one of the two sets grows.
+            auto fits = [&](int set, int seed) {
+                if (auto box = policy.matchesRange(regions[set].lo, regions[set].hi, seed)) return *box;
+                for (int r = set; r >= 0; r = regions[r].next) {
+                    Band const& band = bands[regions[r].seed / gW / kBandRows];
+                    for (int i = regions[r].begin; i < regions[r].end; i++)
+                        if (!policy.matches(band.cells[i], seed)) return false;
+                }
+                return true;
+            };
+            std::unordered_set<uint64_t> failed;
+
+            for (int y = kBandRows; y < gH && !cancel.cancelled(); y += kBandRows) {
+                for (int x = 0; x < gW; x++) {
+                    int up = (y - 1) * gW + x, down = up + gW;
+                    if (labels[up] < 0 || labels[down] < 0) continue;
+                    int a = findRoot(regions, regionAt(up)), b = findRoot(regions, regionAt(down));
+                    if (a == b) continue;
+                    if (regions[b].seed < regions[a].seed) std::swap(a, b);
+                    uint64_t pair = (uint64_t(a) << 32) | uint32_t(b);
+                    if (failed.count(pair)) continue;
+                    if (!fits(b, regions[a].seed)) {
+                        failed.insert(pair);
+                        continue;
+                    }
+                    regions[b].parent = a;
+                    regions[a].lo = channelMin(regions[a].lo, regions[b].lo);
+                    regions[a].hi = channelMax(regions[a].hi, regions[b].hi);
+                    regions[regions[a].last].next = b;
+                    regions[a].last = regions[b].last;
+                }
+            }
+
+            // Roots come in seed order, so numbering them in index order numbers labels by seed.
+            std::vector<int> seeds;
+            std::vector<int> labelOf(regions.size());
+            for (size_t r = 0; r < regions.size(); r++) {
+                int root = findRoot(regions, int(r));
+                if (root == int(r)) {
+                    labelOf[r] = int(seeds.size());
+                    seeds.push_back(regions[r].seed);
+                }
+                else labelOf[r] = labelOf[root];
+            }
+            parallelFor(bandCount, [&](int begin, int end) {
+                for (int b = begin; b < end; b++) {
+                    for (auto const& region : bands[b].regions) {
+                        int label = labelOf[&region - bands[b].regions.data() + offsets[b]];
+                        for (int i = region.begin; i < region.end; i++) labels[bands[b].cells[i]] = label;
+                    }
+                }
+            });
+            return seeds;
+        }
+
+        struct Span {
+            int y0, y1;
+        };
+
+        // Splits the grid into row spans no labelled component crosses. Blocks never mix components,
+        // so covering each span on its own gives the same blocks as covering the whole grid, and every
+        // span only sweeps its own rows.
+        std::vector<Span> splitRows(std::vector<int> const& labels, int gW, int gH, std::vector<Component> const& components) {
+            std::vector<Span> spans;
+            int reach = -1;
+            for (int y = 0; y < gH; y++) {
+                if (y > reach) spans.push_back({ y, y + 1 });
+                for (int x = 0; x < gW; x++) {
+                    int label = labels[size_t(y) * gW + x];
+                    if (label >= 0) reach = std::max(reach, components[label].y1);
+                }
+                spans.back().y1 = std::max(y, reach) + 1;
+            }
+            return spans;
+        }
+
+        // Paints each block with its mean colour when every cell still matches the mean, so the
+        // tolerance keeps capping per-cell error, and with its component's seed otherwise.
+        template <class Policy>
+        void paintBlocks(std::vector<MergeRect>& rects, SampleGrid const& grid, IntegralImage const& integral,
+            Policy const& policy, std::vector<int> const& labels, std::vector<int> const& seeds, CancelToken const& cancel) {
+            int gW = grid.width;
+            for (auto& rect : rects) {
+                if (cancel.cancelled()) return;
+                uint32_t mean = integral.query(rect.x, rect.y, rect.spanX, rect.spanY).meanColor();
+                bool fits = true;
+                for (int y = rect.y; y < rect.y + rect.spanY && fits; y++)
+                    for (int x = rect.x; x < rect.x + rect.spanX && fits; x++)
+                        fits = policy.matchesColor(y * gW + x, mean);
+                rect.color = fits ? mean : grid.cells[seeds[labels[rect.y * gW + rect.x]]];
+            }
+        }
+    }
+
+    std::vector<MergeRect> ComponentMerge::merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const {
+        int gW = grid.width, gH = grid.height;
+
+        return withMatchPolicy(grid, params.metric, params.tolerance, [&](auto const& policy) {
+            std::vector<int> labels;
+            auto seeds = labelComponents(grid, policy, params.cancel, labels);
+            if (params.cancel.cancelled()) return std::vector<MergeRect>();
+
+            std::vector<Component> components(seeds.size(), { gW, gH, -1, -1 });
+            for (int y = 0; y < gH; y++) {
+                for (int x = 0; x < gW; x++) {
+                    int label = labels[size_t(y) * gW + x];
+                    if (label < 0) continue;
+                    auto& c = components[label];
+                    c.x0 = std::min(c.x0, x);
+                    c.x1 = std::max(c.x1, x);
+                    c.y0 = std::min(c.y0, y);
+                    c.y1 = y;
+                    c.cells++;
+                }
+            }
+
+            // Large dense components are covered one each, in parallel, over their bounding box. The
+            // rest share covers over row spans none of them crosses, so neither small components nor
+            // interleaved ones pay for a cover of their own.
+            auto ownsCover = [&](Component const& c) {
+                long long area = (long long)(c.x1 - c.x0 + 1) * (c.y1 - c.y0 + 1);
+                return c.cells >= kMinOwnCells && area <= kMaxSparseness * c.cells;
+            };
+            struct Task {
+                int label;
+                int x0, y0, w, h;
+            };
+            std::vector<Task> tasks;
+            for (size_t i = 0; i < components.size(); i++) {
+                auto const& c = components[i];
+                if (ownsCover(c)) tasks.push_back({ int(i), c.x0, c.y0, c.x1 - c.x0 + 1, c.y1 - c.y0 + 1 });
+            }
+            std::vector<int> shared = labels;
+            if (!tasks.empty()) {
+                for (auto& label : shared)
+                    if (label >= 0 && ownsCover(components[label])) label = -1;
+            }
+            for (auto const& span : splitRows(shared, gW, gH, components))
+                tasks.push_back({ -1, 0, span.y0, gW, span.y1 - span.y0 });
+
+            std::vector<std::vector<MergeRect>> parts(tasks.size());
+            std::atomic<size_t> next{0};
+            parallelFor(int(std::min<size_t>(getThreadCount(), tasks.size())), [&](int, int) {
+                for (size_t i; (i = next.fetch_add(1)) < tasks.size() && !params.cancel.cancelled();) {
+                    auto const& task = tasks[i];
+                    coverLabels(task.label >= 0 ? labels : shared, gW, task.x0, task.y0, task.w, task.h, task.label, params.maxSpan, params.cancel, parts[i]);
+                    paintBlocks(parts[i], grid, integral, policy, labels, seeds, params.cancel);
+                }
+            });
+
+            size_t total = 0;
+            for (auto const& part : parts) total += part.size();
+            std::vector<MergeRect> rects;
+            rects.reserve(total);
+            for (auto const& part : parts) rects.insert(rects.end(), part.begin(), part.end());
+            return rects;
+        });
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace itb {
+    // One bit per grid cell, each row padded to whole 64-bit words. Marking a block is one masked
+    // word write per row and word it touches, and finding the next free or taken cell in a row
+    // skips 64 cells per step.
+    class CoverageMap {
+    public:
+        CoverageMap(int width, int height)
+            : m_width(width), m_stride((size_t(width) + 63) / 64), m_words(m_stride * height, 0) {}
+
+        int getWidth() const { return m_width; }
+
+        bool test(int x, int y) const {
+            return (this->row(y)[x >> 6] >> (x & 63)) & 1;
+        }
+
+        void set(int x, int y) {
+            this->row(y)[x >> 6] |= uint64_t(1) << (x & 63);
+        }
+
+        // Marks [x0, x1) of row y.
+        void fillRow(int y, int x0, int x1) {
+            if (x0 >= x1) return;
+            uint64_t* words = this->row(y);
+            int first = x0 >> 6, last = (x1 - 1) >> 6;
+            uint64_t head = ~uint64_t(0) << (x0 & 63);
+            uint64_t tail = ~uint64_t(0) >> (63 - ((x1 - 1) & 63));
+            if (first == last) {
+                words[first] |= head & tail;
+                return;
+            }
+            words[first] |= head;
+            std::fill(words + first + 1, words + last, ~uint64_t(0));
+            words[last] |= tail;
+        }
+
+        void fillRect(int x, int y, int w, int h) {
+            for (int dy = 0; dy < h; dy++) this->fillRow(y + dy, x, x + w);
+        }
+
+        // First free cell of row y at or after x, or the width when the rest is covered.
+        int nextClear(int y, int x) const {
+            return this->scan(y, x, m_width, ~uint64_t(0));
+        }
+
+        // First covered cell of row y in [x, limit), or limit.
+        int nextSet(int y, int x, int limit) const {
+            return this->scan(y, x, limit, 0);
+        }
+
+        size_t count() const {
+            size_t total = 0;
+            for (uint64_t word : m_words) total += std::popcount(word);
+            return total;
+        }
+
+    private:
+        uint64_t* row(int y) { return m_words.data() + size_t(y) * m_stride; }
+        uint64_t const* row(int y) const { return m_words.data() + size_t(y) * m_stride; }
+
+        // Finds the first bit differing from `flip` (all ones to look for a clear bit, zero for a set one).
+        int scan(int y, int x, int limit, uint64_t flip) const {
+            if (x >= limit) return limit;
+            uint64_t const* words = this->row(y);
+            int w = x >> 6;
+            uint64_t bits = (words[w] ^ flip) & (~uint64_t(0) << (x & 63));
+            int end = (limit + 63) >> 6;
+            while (!bits) {
+                if (++w >= end) return limit;
+                bits = words[w] ^ flip;
+            }
+            return std::min(limit, (w << 6) + std::countr_zero(bits));
+        }
+
+        int m_width;
+        size_t m_stride;
+        std::vector<uint64_t> m_words;
+    };
+}
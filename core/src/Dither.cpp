@@ -0,0 +1,337 @@
+#include "Dither.hpp"
+#include "SimdTargets.hpp"
+
+#include <itb/Parallel.hpp>
+#include <itb/Simd.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+namespace itb {
+    namespace {
+        constexpr int kBlueNoiseSize = 32;
+
+        // Per matrix column, the positive and negative parts of the RGB offset as byte lanes, so
+        // kernels add them with saturating byte arithmetic. Alpha lanes stay zero.
+        struct OffsetRow {
+            std::vector<uint32_t> plus, minus;
+        };
+
+        using OrderedKernel = void (*)(uint32_t const* in, uint32_t* out, int width, OffsetRow const& offsets,
+            int period, uint32_t const* binColor);
+
+        uint32_t mapCell(uint32_t original, uint32_t shifted, uint32_t const* binColor) {
+            if (cellAlpha(original) < 200) return original;
+            return binColor[binIndex(shifted)] | (original & 0xFF000000u);
+        }
+
+        uint32_t saturate(uint32_t cell, uint32_t plus, uint32_t minus) {
+            uint32_t out = 0;
+            for (int shift = 0; shift < 24; shift += 8) {
+                int v = int(cell >> shift & 0xFF) + int(plus >> shift & 0xFF) - int(minus >> shift & 0xFF);
+                out |= uint32_t(std::clamp(v, 0, 255)) << shift;
+            }
+            return out | (cell & 0xFF000000u);
+        }
+
+        void orderedScalar(uint32_t const* in, uint32_t* out, int width, OffsetRow const& offsets, int period, uint32_t const* binColor) {
+            for (int x = 0; x < width; x++) {
+                int k = x % period;
+                out[x] = mapCell(in[x], saturate(in[x], offsets.plus[k], offsets.minus[k]), binColor);
+            }
+        }
+
+#if ITB_X86
+        void orderedSse2(uint32_t const* in, uint32_t* out, int width, OffsetRow const& offsets, int period, uint32_t const* binColor) {
+            __m128i const redMask = _mm_set1_epi32(0xF8), greenMask = _mm_set1_epi32(0x3E0), blueMask = _mm_set1_epi32(0x1F);
+            alignas(16) uint32_t bins[4];
+            int x = 0;
+            for (; x + 4 <= width; x += 4) {
+                int k = x % period;
+                __m128i cells = _mm_loadu_si128((__m128i const*)(in + x));
+                __m128i shifted = _mm_subs_epu8(
+                    _mm_adds_epu8(cells, _mm_loadu_si128((__m128i const*)(offsets.plus.data() + k))),
+                    _mm_loadu_si128((__m128i const*)(offsets.minus.data() + k)));
+                __m128i index = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(shifted, redMask), 7),
+                    _mm_or_si128(_mm_and_si128(_mm_srli_epi32(shifted, 6), greenMask), _mm_and_si128(_mm_srli_epi32(shifted, 19), blueMask)));
+                _mm_store_si128((__m128i*)bins, index);
+                for (int i = 0; i < 4; i++) {
+                    uint32_t cell = in[x + i];
+                    out[x + i] = cellAlpha(cell) < 200 ? cell : binColor[bins[i]] | (cell & 0xFF000000u);
+                }
+            }
+            for (; x < width; x++) {
+                int k = x % period;
+                out[x] = mapCell(in[x], saturate(in[x], offsets.plus[k], offsets.minus[k]), binColor);
+            }
+        }
+
+        ITB_TARGET_AVX2 void orderedAvx2(uint32_t const* in, uint32_t* out, int width, OffsetRow const& offsets, int period, uint32_t const* binColor) {
+            __m256i const redMask = _mm256_set1_epi32(0xF8), greenMask = _mm256_set1_epi32(0x3E0), blueMask = _mm256_set1_epi32(0x1F);
+            __m256i const opaque = _mm256_set1_epi32(199);
+            int x = 0;
+            for (; x + 8 <= width; x += 8) {
+                int k = x % period;
+                __m256i cells = _mm256_loadu_si256((__m256i const*)(in + x));
+                __m256i shifted = _mm256_subs_epu8(
+                    _mm256_adds_epu8(cells, _mm256_loadu_si256((__m256i const*)(offsets.plus.data() + k))),
+                    _mm256_loadu_si256((__m256i const*)(offsets.minus.data() + k)));
+                __m256i index = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(shifted, redMask), 7),
+                    _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(shifted, 6), greenMask), _mm256_and_si256(_mm256_srli_epi32(shifted, 19), blueMask)));
+                __m256i mapped = _mm256_or_si256(_mm256_i32gather_epi32((int const*)binColor, index, 4),
+                    _mm256_and_si256(cells, _mm256_set1_epi32(int(0xFF000000u))));
+                __m256i keep = _mm256_cmpgt_epi32(opaque, _mm256_srli_epi32(cells, 24));
+                _mm256_storeu_si256((__m256i*)(out + x), _mm256_blendv_epi8(mapped, cells, keep));
+            }
+            for (; x < width; x++) {
+                int k = x % period;
+                out[x] = mapCell(in[x], saturate(in[x], offsets.plus[k], offsets.minus[k]), binColor);
+            }
+        }
+#endif
+
+#if ITB_NEON
+        void orderedNeon(uint32_t const* in, uint32_t* out, int width, OffsetRow const& offsets, int period, uint32_t const* binColor) {
+            uint32x4_t const redMask = vdupq_n_u32(0xF8), greenMask = vdupq_n_u32(0x3E0), blueMask = vdupq_n_u32(0x1F);
+            uint32_t bins[4];
+            int x = 0;
+            for (; x + 4 <= width; x += 4) {
+                int k = x % period;
+                uint8x16_t cells = vld1q_u8((uint8_t const*)(in + x));
+                uint8x16_t shifted = vqsubq_u8(vqaddq_u8(cells, vld1q_u8((uint8_t const*)(offsets.plus.data() + k))),
+                    vld1q_u8((uint8_t const*)(offsets.minus.data() + k)));
+                uint32x4_t s = vreinterpretq_u32_u8(shifted);
+                uint32x4_t index = vorrq_u32(vshlq_n_u32(vandq_u32(s, redMask), 7),
+                    vorrq_u32(vandq_u32(vshrq_n_u32(s, 6), greenMask), vandq_u32(vshrq_n_u32(s, 19), blueMask)));
+                vst1q_u32(bins, index);
+                for (int i = 0; i < 4; i++) {
+                    uint32_t cell = in[x + i];
+                    out[x + i] = cellAlpha(cell) < 200 ? cell : binColor[bins[i]] | (cell & 0xFF000000u);
+                }
+            }
+            for (; x < width; x++) {
+                int k = x % period;
+                out[x] = mapCell(in[x], saturate(in[x], offsets.plus[k], offsets.minus[k]), binColor);
+            }
+        }
+#endif
+
+        OrderedKernel orderedKernel() {
+            switch (getSimdLevel()) {
+#if ITB_X86
+                case SimdLevel::AVX2: return orderedAvx2;
+                case SimdLevel::SSE2: return orderedSse2;
+#endif
+#if ITB_NEON
+                case SimdLevel::NEON: return orderedNeon;
+#endif
+                default: return orderedScalar;
+            }
+        }
+
+        // Ulichney's void-and-cluster on a torus with a Gaussian energy filter (sigma 1.5).
+        std::vector<uint16_t> makeBlueNoise(int n) {
+            int size = n * n;
+            std::vector<float> kernel(size);
+            for (int y = 0; y < n; y++) {
+                for (int x = 0; x < n; x++) {
+                    int dx = std::min(x, n - x), dy = std::min(y, n - y);
+                    kernel[y * n + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * 1.5f * 1.5f));
+                }
+            }
+
+            std::vector<uint8_t> pattern(size, 0);
+            std::vector<float> energy(size, 0.0f);
+            auto toggle = [&](int at, bool on) {
+                pattern[at] = on;
+                int ax = at % n, ay = at / n;
+                float sign = on ? 1.0f : -1.0f;
+                for (int y = 0; y < n; y++)
+                    for (int x = 0; x < n; x++)
+                        energy[y * n + x] += sign * kernel[((y - ay + n) % n) * n + (x - ax + n) % n];
+            };
+            auto extreme = [&](bool ones, bool highest) {
+                int best = -1;
+                for (int i = 0; i < size; i++) {
+                    if (bool(pattern[i]) != ones) continue;
+                    if (best < 0 || (highest ? energy[i] > energy[best] : energy[i] < energy[best])) best = i;
+                }
+                return best;
+            };
+
+            // Deterministic sparse seed, relaxed until the tightest cluster is also the largest void.
+            uint32_t seed = 12345;
+            int initial = size / 10;
+            for (int placed = 0; placed < initial;) {
+                seed = seed * 1664525u + 1013904223u;
+                int at = int(seed >> 8) % size;
+                if (pattern[at]) continue;
+                toggle(at, true);
+                placed++;
+            }
+            for (int pass = 0; pass < size * 4; pass++) {
+                int cluster = extreme(true, true);
+                toggle(cluster, false);
+                int voidAt = extreme(false, false);
+                if (voidAt == cluster) {
+                    toggle(cluster, true);
+                    break;
+                }
+                toggle(voidAt, true);
+            }
+
+            std::vector<uint16_t> ranks(size);
+            auto prototype = pattern;
+            auto prototypeEnergy = energy;
+            for (int rank = initial - 1; rank >= 0; rank--) {
+                int cluster = extreme(true, true);
+                toggle(cluster, false);
+                ranks[cluster] = uint16_t(rank);
+            }
+            pattern = prototype;
+            energy = prototypeEnergy;
+            for (int rank = initial; rank < size; rank++) {
+                int voidAt = extreme(false, false);
+                toggle(voidAt, true);
+                ranks[voidAt] = uint16_t(rank);
+            }
+            return ranks;
+        }
+    }
+
+    std::vector<uint32_t> nearestBinColors(std::vector<uint32_t> const& palette) {
+        std::vector<uint32_t> table(1 << 15);
+        parallelFor(int(table.size()), [&](int begin, int end) {
+            for (int bin = begin; bin < end; bin++) {
+                int r = (bin >> 10) << 3 | 4, g = (bin >> 5 & 31) << 3 | 4, b = (bin & 31) << 3 | 4;
+                int best = 0, bestDistance = 1 << 30;
+                for (size_t i = 0; i < palette.size(); i++) {
+                    int dr = r - cellRed(palette[i]), dg = g - cellGreen(palette[i]), db = b - cellBlue(palette[i]);
+                    int distance = dr * dr + dg * dg + db * db;
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        best = int(i);
+                    }
+                }
+                table[bin] = palette[best];
+            }
+        }, 1024);
+        return table;
+    }
+
+    std::vector<uint16_t> const& bayerMatrix() {
+        static std::vector<uint16_t> const matrix = [] {
+            std::vector<uint16_t> m(1, 0);
+            for (int n = 1; n < 8; n *= 2) {
+                std::vector<uint16_t> next(4 * n * n);
+                for (int y = 0; y < n; y++) {
+                    for (int x = 0; x < n; x++) {
+                        uint16_t v = uint16_t(4 * m[y * n + x]);
+                        next[y * 2 * n + x] = v;
+                        next[y * 2 * n + x + n] = v + 2;
+                        next[(y + n) * 2 * n + x] = v + 3;
+                        next[(y + n) * 2 * n + x + n] = v + 1;
+                    }
+                }
+                m = std::move(next);
+            }
+            return m;
+        }();
+        return matrix;
+    }
+
+    std::vector<uint16_t> const& blueNoiseMatrix() {
+        static std::vector<uint16_t> const matrix = makeBlueNoise(kBlueNoiseSize);
+        return matrix;
+    }
+
+    void ditherOrdered(SampleGrid const& in, SampleGrid& out, uint32_t const* binColor, std::vector<uint16_t> const& matrix, int amplitude) {
+        int n = int(std::lround(std::sqrt(double(matrix.size()))));
+        int levels = n * n;
+
+        // Each matrix row becomes offset lanes repeated to cover one SIMD load past the period.
+        std::vector<OffsetRow> rows(n);
+        for (int y = 0; y < n; y++) {
+            rows[y].plus.resize(n + 8);
+            rows[y].minus.resize(n + 8);
+            for (int x = 0; x < n + 8; x++) {
+                int offset = int(std::lround(((matrix[y * n + x % n] + 0.5) / levels - 0.5) * amplitude));
+                uint32_t lanes = uint32_t(std::abs(offset)) * 0x010101u;
+                rows[y].plus[x] = offset > 0 ? lanes : 0;
+                rows[y].minus[x] = offset < 0 ? lanes : 0;
+            }
+        }
+
+        OrderedKernel kernel = orderedKernel();
+        parallelFor(in.height, [&](int begin, int end) {
+            for (int y = begin; y < end; y++) {
+                size_t row = size_t(y) * in.width;
+                kernel(&in.cells[row], &out.cells[row], in.width, rows[y % n], n, binColor);
+            }
+        }, 16);
+    }
+
+    void ditherFloydSteinberg(SampleGrid const& in, SampleGrid& out, uint32_t const* binColor) {
+        int width = in.width, height = in.height;
+        if (width <= 0 || height <= 0) return;
+        int lanes = std::max(1, std::min(getThreadCount(), height));
+
+        // Incoming error for a row lives in a ring slot, padded by one cell on each side. At most
+        // `lanes` rows are in flight, so lanes + 2 slots never overwrite a row still being read.
+        int ringRows = lanes + 2;
+        size_t stride = size_t(width + 2) * 3;
+        std::vector<int> errors(stride * ringRows, 0);
+        std::vector<std::atomic<int>> progress(height);
+        for (auto& done : progress) done.store(0, std::memory_order_relaxed);
+
+        auto runRow = [&](int y) {
+            int* incoming = &errors[stride * (y % ringRows)];
+            int* below = &errors[stride * ((y + 1) % ringRows)];
+            std::fill(below, below + stride, 0);
+
+            int carry[3] = {};
+            for (int x = 0; x < width; x++) {
+                // Row y - 1 has written everything cell x reads once it is two cells ahead.
+                if (y > 0) {
+                    int need = std::min(width, x + 2);
+                    while (progress[y - 1].load(std::memory_order_acquire) < need) std::this_thread::yield();
+                }
+
+                size_t idx = size_t(y) * width + x;
+                uint32_t cell = in.cells[idx];
+                if (cellAlpha(cell) < 200) {
+                    out.cells[idx] = cell;
+                    carry[0] = carry[1] = carry[2] = 0;
+                } else {
+                    int wanted[3];
+                    uint32_t shifted = cell & 0xFF000000u;
+                    for (int c = 0; c < 3; c++) {
+                        // Errors are kept in sixteenths.
+                        wanted[c] = std::clamp(int(cell >> (c * 8) & 0xFF) + (incoming[(x + 1) * 3 + c] + carry[c] + 8) / 16, 0, 255);
+                        shifted |= uint32_t(wanted[c]) << (c * 8);
+                    }
+                    uint32_t chosen = binColor[binIndex(shifted)];
+                    out.cells[idx] = chosen | (cell & 0xFF000000u);
+                    for (int c = 0; c < 3; c++) {
+                        int error = wanted[c] - int(chosen >> (c * 8) & 0xFF);
+                        carry[c] = 7 * error;
+                        below[x * 3 + c] += 3 * error;
+                        below[(x + 1) * 3 + c] += 5 * error;
+                        below[(x + 2) * 3 + c] += error;
+                    }
+                }
+                progress[y].store(x + 1, std::memory_order_release);
+            }
+        };
+
+        // Lane t owns rows t, t + lanes, ...; a lane visits its rows in order, so it never waits
+        // on itself.
+        parallelFor(lanes, [&](int begin, int end) {
+            for (int base = 0; base < height; base += lanes) {
+                for (int lane = begin; lane < end && base + lane < height; lane++) runRow(base + lane);
+            }
+        });
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <itb/SampleGrid.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace itb {
+    // 15-bit histogram bin of a cell: 5 bits per channel, red highest.
+    inline int binIndex(uint32_t cell) {
+        return int((cell & 0xF8) << 7 | (cell >> 6 & 0x3E0) | (cell >> 19 & 0x1F));
+    }
+
+    // Nearest palette colour (packed RGB, alpha 0) for the centre of every 15-bit bin.
+    std::vector<uint32_t> nearestBinColors(std::vector<uint32_t> const& palette);
+
+    // n x n threshold ranks 0 .. n*n - 1: a recursive Bayer matrix (n = 8) and a void-and-cluster
+    // blue-noise mask (n = 32), each built once.
+    std::vector<uint16_t> const& bayerMatrix();
+    std::vector<uint16_t> const& blueNoiseMatrix();
+
+    // Offsets each opaque cell's RGB by its threshold rank scaled to +-amplitude / 2, then maps it
+    // through `binColor`. Rows run in parallel; the offset and bin computation uses SIMD.
+    void ditherOrdered(SampleGrid const& in, SampleGrid& out, uint32_t const* binColor,
+        std::vector<uint16_t> const& matrix, int amplitude);
+    // Floyd-Steinberg error diffusion. Row y only needs row y - 1 two cells ahead of it, so rows are
+    // dealt round-robin to threads that trail each other in a wavefront.
+    void ditherFloydSteinberg(SampleGrid const& in, SampleGrid& out, uint32_t const* binColor);
+}
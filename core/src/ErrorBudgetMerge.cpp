@@ -0,0 +1,36 @@
+#include "CoverageMap.hpp"
+#include "MergeStrategies.hpp"
+
+#include <algorithm>
+
+namespace itb {
+    std::vector<MergeRect> ErrorBudgetMerge::merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const {
+        int gW = grid.width, gH = grid.height;
+        int maxSpan = std::max(1, params.maxSpan);
+        double budget = maxBlockVariance(params.tolerance);
+
+        auto fits = [&](int x, int y, int w, int h) {
+            auto stats = integral.query(x, y, w, h);
+            return stats.isOpaque() && stats.variance() <= budget;
+        };
+
+        std::vector<MergeRect> rects;
+        CoverageMap visited(gW, gH);
+
+        for (int gy = 0; gy < gH && !params.cancel.cancelled(); gy++) {
+            for (int gx = visited.nextClear(gy, 0); gx < gW; gx = visited.nextClear(gy, gx + 1)) {
+                if (cellAlpha(grid.cells[gy * gW + gx]) < 200) continue;
+
+                int spX = 1, spY = 1;
+                int limit = visited.nextSet(gy, gx + 1, std::min(gW, gx + maxSpan)) - gx;
+                while (spX < limit && fits(gx, gy, spX + 1, 1)) spX++;
+                // Rows below are unclaimed within [gx, gx + spX), as in GreedyMerge.
+                while (gy + spY < gH && spY < maxSpan && fits(gx, gy, spX, spY + 1)) spY++;
+
+                visited.fillRect(gx, gy, spX, spY);
+                rects.push_back({ gx, gy, spX, spY, integral.query(gx, gy, spX, spY).meanColor() });
+            }
+        }
+        return rects;
+    }
+}
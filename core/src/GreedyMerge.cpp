@@ -0,0 +1,259 @@
+#include "CoverageMap.hpp"
+#include "MatchPolicy.hpp"
+#include "MergeStrategies.hpp"
+#include "RunRows.hpp"
+
+#include <itb/Parallel.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <tuple>
+
+namespace itb {
+    namespace {
+        // Grids with fewer runs than cells / kCellsPerRun take the run-length path.
+        constexpr size_t kCellsPerRun = 3;
+        // Grids wider or taller than this are merged as independent tiles of this size. The tiling
+        // never depends on the thread count, so neither does the output.
+        constexpr int kTileSize = 256;
+
+        template <class Policy>
+        std::vector<MergeRect> mergeCells(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params, Policy const& policy) {
+            int gW = grid.width, gH = grid.height;
+            int maxSpan = params.maxSpan;
+            uint32_t const* cells = grid.cells.data();
+
+            std::vector<MergeRect> rects;
+            CoverageMap visited(gW, gH);
+
+            for (int gy = 0; gy < gH && !params.cancel.cancelled(); gy++) {
+                for (int gx = visited.nextClear(gy, 0); gx < gW; gx = visited.nextClear(gy, gx + 1)) {
+                    int idx = gy * gW + gx;
+                    uint32_t base = cells[idx];
+                    if (cellAlpha(base) < 200) continue;
+
+                    int limit = visited.nextSet(gy, gx + 1, std::min(gW, gx + maxSpan));
+                    int spX = policy.runEnd(idx + 1, idx + limit - gx, idx) - idx;
+                    int spY = 1;
+
+                    // Rows below the current one inside [gx, gx + spX) can't have been claimed yet: any
+                    // earlier block reaching them also covers row gy, which would have stopped spX.
+                    while (gy + spY < gH && spY < maxSpan) {
+                        // Every cell matching base implies an opaque row the policy can't reject; a
+                        // uniform row is settled by its first cell. Only the rest is scanned.
+                        auto row = integral.query(gx, gy + spY, spX, 1);
+                        int rowIdx = idx + spY * gW;
+                        bool canY;
+                        if (!row.isOpaque() || policy.rejectsRow(row, base)) canY = false;
+                        else if (row.isUniform()) canY = policy.matches(rowIdx, idx);
+                        else canY = policy.runEnd(rowIdx, rowIdx + spX, idx) == rowIdx + spX;
+                        if (!canY) break;
+                        spY++;
+                    }
+
+                    visited.fillRect(gx, gy, spX, spY);
+                    rects.push_back({ gx, gy, spX, spY, base });
+                }
+            }
+            return rects;
+        }
+
+        // Same scan as mergeCells, one run at a time. Every cell of a run has the same colour, so a run
+        // matches or fails as a whole. Instead of a visited map, each column keeps the row its covering
+        // block stops at and a block's first column keeps its right edge. Produces exactly the
+        // rectangles mergeCells does.
+        template <class Policy>
+        std::vector<MergeRect> mergeRuns(SampleGrid const& grid, RunRows const& runs, MergeParams const& params, Policy const& policy) {
+            int gW = grid.width, gH = grid.height;
+            int maxSpan = params.maxSpan;
+
+            auto matches = [&](int y, Run const& run, int base) {
+                return policy.matches(y * gW + run.start, base);
+            };
+
+            std::vector<MergeRect> rects;
+            std::vector<int> coveredUntil(gW, 0);
+            std::vector<int> coveredEnd(gW, 0);
+            // Probes into a row mostly move rightwards, so each row resumes from its last probed run.
+            std::vector<Run const*> probe(gH);
+            for (int y = 0; y < gH; y++) probe[y] = runs.rowBegin(y);
+
+            for (int gy = 0; gy < gH && !params.cancel.cancelled(); gy++) {
+                Run const* run = runs.rowBegin(gy);
+
+                for (int gx = 0; gx < gW;) {
+                    // The scan only ever lands on the first column of a block from an earlier row.
+                    if (coveredUntil[gx] > gy) {
+                        gx = coveredEnd[gx];
+                        continue;
+                    }
+                    while (run->start + run->length <= gx) run++;
+
+                    // Covered cells are always opaque, so a transparent run is skipped whole.
+                    if (cellAlpha(run->color) < 200) {
+                        gx = run->start + run->length;
+                        continue;
+                    }
+
+                    int idx = gy * gW + gx;
+                    int limit = std::min(gW, gx + maxSpan);
+                    for (int x = gx + 1; x < limit; x++) {
+                        if (coveredUntil[x] > gy) {
+                            limit = x; break;
+                        }
+                    }
+
+                    int end = std::min(limit, run->start + run->length);
+                    for (Run const* next = run + 1; end < limit && matches(gy, *next, idx); next++)
+                        end = std::min(limit, next->start + next->length);
+                    int spX = end - gx;
+
+                    int spY = 1;
+                    while (gy + spY < gH && spY < maxSpan) {
+                        int y = gy + spY;
+                        // Test each run under [gx, end) once, stopping at the one that reaches end.
+                        bool canY = true;
+                        Run const* below = probe[y];
+                        if (below->start > gx) below = runs.find(y, gx);
+                        while (below->start + below->length <= gx) below++;
+                        probe[y] = below;
+                        for (;; below++) {
+                            if (!matches(y, *below, idx)) {
+                                canY = false; break;
+                            }
+                            if (below->start + below->length >= end) break;
+                        }
+                        if (!canY) break;
+                        spY++;
+                    }
+
+                    if (spY > 1) {
+                        std::fill(coveredUntil.begin() + gx, coveredUntil.begin() + end, gy + spY);
+                        coveredEnd[gx] = end;
+                    }
+                    rects.push_back({ gx, gy, spX, spY, run->color });
+                    gx = end;
+                }
+            }
+            return rects;
+        }
+        // `integral` may be null, in which case the cell scan builds the tile's own tables.
+        std::vector<MergeRect> mergeTile(SampleGrid const& grid, IntegralImage const* integral, MergeParams const& params) {
+            // Flat-colour art collapses to a few runs per row; photos barely compress and keep the cell scan.
+            RunRows runs(grid);
+            bool useRuns = runs.getRunCount() * kCellsPerRun < grid.cells.size();
+            return withMatchPolicy(grid, params.metric, params.tolerance, [&](auto const& policy) {
+                if (useRuns) return mergeRuns(grid, runs, params, policy);
+                if (integral) return mergeCells(grid, *integral, params, policy);
+                return mergeCells(grid, IntegralImage(grid), params, policy);
+            });
+        }
+
+        // Fuses blocks that meet edge to edge on a tile seam: same rows (or columns), combined span
+        // within maxSpan, and every cell of the second block within tolerance of the first block's
+        // base cell, which is exactly what the untiled scan would have required. Vertical seams go
+        // first, then horizontal ones, each in a fixed order so the result is deterministic.
+        template <class Policy>
+        void stitchSeams(SampleGrid const& grid, std::vector<MergeRect>& rects, int maxSpan, Policy const& policy) {
+            int gW = grid.width;
+            auto joins = [&](MergeRect const& a, MergeRect const& b) {
+                int base = a.y * gW + a.x;
+                for (int y = b.y; y < b.y + b.spanY; y++) {
+                    int row = y * gW;
+                    if (policy.runEnd(row + b.x, row + b.x + b.spanX, base) != row + b.x + b.spanX) return false;
+                }
+                return true;
+            };
+
+            std::vector<bool> dead(rects.size(), false);
+            std::vector<size_t> order;
+            auto pass = [&](bool across) {
+                // Only blocks starting or ending on a seam can fuse; those of one band end up adjacent,
+                // ordered along it.
+                order.clear();
+                for (size_t i = 0; i < rects.size(); i++) {
+                    auto const& r = rects[i];
+                    int start = across ? r.x : r.y, end = start + (across ? r.spanX : r.spanY);
+                    if (!dead[i] && (start % kTileSize == 0 || end % kTileSize == 0)) order.push_back(i);
+                }
+                std::sort(order.begin(), order.end(), [&](size_t i, size_t j) {
+                    auto const& a = rects[i];
+                    auto const& b = rects[j];
+                    if (across) return std::tie(a.y, a.spanY, a.x) < std::tie(b.y, b.spanY, b.x);
+                    return std::tie(a.x, a.spanX, a.y) < std::tie(b.x, b.spanX, b.y);
+                });
+                if (order.empty()) return;
+                size_t anchor = order[0];
+                for (size_t k = 1; k < order.size(); k++) {
+                    auto& a = rects[anchor];
+                    auto const& b = rects[order[k]];
+                    bool fused;
+                    if (across) {
+                        fused = a.y == b.y && a.spanY == b.spanY && a.x + a.spanX == b.x && b.x % kTileSize == 0 &&
+                            a.spanX + b.spanX <= maxSpan && joins(a, b);
+                        if (fused) a.spanX += b.spanX;
+                    } else {
+                        fused = a.x == b.x && a.spanX == b.spanX && a.y + a.spanY == b.y && b.y % kTileSize == 0 &&
+                            a.spanY + b.spanY <= maxSpan && joins(a, b);
+                        if (fused) a.spanY += b.spanY;
+                    }
+                    if (fused) dead[order[k]] = true;
+                    else anchor = order[k];
+                }
+            };
+            pass(true);
+            pass(false);
+
+            size_t kept = 0;
+            for (size_t i = 0; i < rects.size(); i++)
+                if (!dead[i]) rects[kept++] = rects[i];
+            rects.resize(kept);
+        }
+    }
+
+    bool GreedyMerge::usesIntegral(SampleGrid const& grid) const {
+        return grid.width <= kTileSize && grid.height <= kTileSize;
+    }
+
+    std::vector<MergeRect> GreedyMerge::merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const {
+        int gW = grid.width, gH = grid.height;
+        if (gW <= kTileSize && gH <= kTileSize) return mergeTile(grid, &integral, params);
+
+        int tilesX = (gW + kTileSize - 1) / kTileSize, tilesY = (gH + kTileSize - 1) / kTileSize;
+        int tileCount = tilesX * tilesY;
+        std::vector<std::vector<MergeRect>> tileRects(tileCount);
+        // Tiles cost very different amounts, so workers pull them one at a time.
+        std::atomic<int> nextTile{0};
+        parallelFor(std::min(getThreadCount(), tileCount), [&](int, int) {
+            for (int t; (t = nextTile.fetch_add(1)) < tileCount && !params.cancel.cancelled();) {
+                int x0 = t % tilesX * kTileSize, y0 = t / tilesX * kTileSize;
+                SampleGrid tile { std::min(kTileSize, gW - x0), std::min(kTileSize, gH - y0), {} };
+                tile.cells.reserve(size_t(tile.width) * tile.height);
+                for (int y = 0; y < tile.height; y++) {
+                    auto row = grid.cells.begin() + size_t(y0 + y) * gW + x0;
+                    tile.cells.insert(tile.cells.end(), row, row + tile.width);
+                }
+                tileRects[t] = mergeTile(tile, nullptr, params);
+                for (auto& rect : tileRects[t]) {
+                    rect.x += x0;
+                    rect.y += y0;
+                }
+            }
+        });
+
+        size_t total = 0;
+        for (auto const& part : tileRects) total += part.size();
+        std::vector<MergeRect> rects;
+        rects.reserve(total);
+        for (auto& part : tileRects) {
+            rects.insert(rects.end(), part.begin(), part.end());
+            std::vector<MergeRect>().swap(part);
+        }
+        if (params.cancel.cancelled()) return rects;
+        withMatchPolicy(grid, params.metric, params.tolerance, [&](auto const& policy) {
+            stitchSeams(grid, rects, params.maxSpan, policy);
+        });
+        return rects;
+    }
+}
@@ -0,0 +1,159 @@
+#include <itb/Image.hpp>
+#include <itb/SampleGrid.hpp>
+
+#include "AreaSampler.hpp"
+#include "JpegScaled.hpp"
+#include "PngStream.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace itb {
+    namespace {
+        struct StreamReader {
+            std::ifstream file;
+        };
+
+        int streamRead(void* user, char* data, int size) {
+            auto& file = static_cast<StreamReader*>(user)->file;
+            file.read(data, size);
+            return (int)file.gcount();
+        }
+
+        void streamSkip(void* user, int n) {
+            auto& file = static_cast<StreamReader*>(user)->file;
+            file.clear();
+            file.seekg(n, std::ios::cur);
+        }
+
+        int streamEof(void* user) {
+            return static_cast<StreamReader*>(user)->file.eof() ? 1 : 0;
+        }
+
+        stbi_io_callbacks const streamCallbacks = { streamRead, streamSkip, streamEof };
+
+        // PNG stores its sample depth in IHDR, which always directly follows the signature.
+        std::optional<int> pngBitDepth(std::span<const unsigned char> header) {
+            static unsigned char const signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+            if (header.size() < 25 || !std::equal(signature, signature + 8, header.begin())) return std::nullopt;
+            return header[24];
+        }
+    }
+
+    std::optional<std::vector<unsigned char>> readFile(std::filesystem::path const& path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) return std::nullopt;
+
+        auto size = file.tellg();
+        if (size < 0) return std::nullopt;
+
+        std::vector<unsigned char> data(static_cast<size_t>(size));
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char*>(data.data()), size)) return std::nullopt;
+        return data;
+    }
+
+    std::optional<ImageInfo> probeImage(std::span<const unsigned char> data) {
+        ImageInfo info;
+        if (!stbi_info_from_memory(data.data(), (int)data.size(), &info.width, &info.height, &info.channels)) return std::nullopt;
+        if (auto depth = pngBitDepth(data)) info.bitDepth = *depth;
+        else if (stbi_is_16_bit_from_memory(data.data(), (int)data.size())) info.bitDepth = 16;
+        return info;
+    }
+
+    std::optional<ImageInfo> probeImageFile(std::filesystem::path const& path) {
+        StreamReader reader{ std::ifstream(path, std::ios::binary) };
+        if (!reader.file) return std::nullopt;
+
+        unsigned char header[32] = {};
+        reader.file.read(reinterpret_cast<char*>(header), sizeof(header));
+        auto headerSize = (size_t)reader.file.gcount();
+
+        ImageInfo info;
+        reader.file.clear();
+        reader.file.seekg(0);
+        if (!stbi_info_from_callbacks(&streamCallbacks, &reader, &info.width, &info.height, &info.channels)) return std::nullopt;
+
+        if (auto depth = pngBitDepth({ header, headerSize })) info.bitDepth = *depth;
+        else {
+            reader.file.clear();
+            reader.file.seekg(0);
+            if (stbi_is_16_bit_from_callbacks(&streamCallbacks, &reader)) info.bitDepth = 16;
+        }
+        return info;
+    }
+
+    std::optional<Image> decodeImage(std::span<const unsigned char> data) {
+        int w, h, ch;
+        unsigned char* pixels = stbi_load_from_memory(data.data(), (int)data.size(), &w, &h, &ch, 4);
+        if (!pixels) return std::nullopt;
+
+        Image image;
+        image.width = w;
+        image.height = h;
+        image.pixels.assign(pixels, pixels + (size_t)w * h * 4);
+        stbi_image_free(pixels);
+        return image;
+    }
+
+    std::optional<SampleGrid> decodeSampled(std::span<const unsigned char> data, int step, SampleMode mode) {
+        step = std::max(1, step);
+        bool average = mode == SampleMode::Average && step > 1;
+
+        PngRowReader png;
+        if (png.open(data)) {
+            SampleGrid grid;
+            grid.width = (png.getWidth() + step - 1) / step;
+            grid.height = (png.getHeight() + step - 1) / step;
+            grid.cells.resize((size_t)grid.width * grid.height);
+
+            bool ok;
+            if (average) {
+                AreaAccumulator accumulator(png.getWidth(), step);
+                int lastRow = png.getHeight() - 1;
+                ok = png.readRows(1, [&](int y, unsigned char const* rgba) {
+                    accumulator.addRow(rgba);
+                    if ((y + 1) % step == 0 || y == lastRow) accumulator.finish(&grid.cells[(size_t)(y / step) * grid.width]);
+                });
+            }
+            else {
+                ok = png.readRows(step, [&](int y, unsigned char const* rgba) {
+                    uint32_t* out = &grid.cells[(size_t)(y / step) * grid.width];
+                    for (int gx = 0; gx < grid.width; gx++) {
+                        unsigned char const* p = rgba + (size_t)gx * step * 4;
+                        out[gx] = packRGBA(p[0], p[1], p[2], p[3]);
+                    }
+                });
+            }
+            if (ok) return grid;
+        }
+
+        // JPEG blocks can be decoded straight at 1/2, 1/4 or 1/8 size. Point sampling takes the
+        // coarsest scale that still has a reduced pixel per cell; averaging needs one that divides
+        // the step so every cell covers whole reduced pixels.
+        bool isJpeg = data.size() > 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+        if (isJpeg && step >= 2) {
+            int scale = 1;
+            for (int candidate : { 8, 4, 2 }) {
+                if (step >= candidate && (!average || step % candidate == 0)) {
+                    scale = candidate;
+                    break;
+                }
+            }
+            auto info = probeImage(data);
+            if (scale > 1 && info) {
+                if (auto reduced = decodeJpegScaled(data, scale)) {
+                    if (average) return averageGrid(*reduced, step / scale);
+                    return sampleGridReduced(*reduced, info->width, info->height, step, scale);
+                }
+            }
+        }
+
+        auto image = decodeImage(data);
+        if (!image) return std::nullopt;
+        return average ? averageGrid(*image, step) : sampleGrid(*image, step);
+    }
+}
@@ -0,0 +1,117 @@
+#include <itb/ImageCache.hpp>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+namespace itb {
+    ImageHandle::ImageHandle(std::filesystem::path path, std::filesystem::file_time_type mtime)
+        : m_path(std::move(path)), m_mtime(mtime) {}
+
+    std::shared_ptr<const std::vector<unsigned char>> ImageHandle::loadBytesLocked() {
+        if (!m_bytes) {
+            if (auto data = readFile(m_path)) {
+                m_bytes = std::make_shared<const std::vector<unsigned char>>(std::move(*data));
+            }
+        }
+        return m_bytes;
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> ImageHandle::takeBytesLocked() {
+        this->loadBytesLocked();
+        return std::move(m_bytes);
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> ImageHandle::getBytes() {
+        std::lock_guard lock(m_mutex);
+        return this->loadBytesLocked();
+    }
+
+    std::optional<ImageInfo> ImageHandle::getInfo() {
+        std::lock_guard lock(m_mutex);
+        if (m_info) return m_info;
+        m_info = m_bytes ? probeImage(*m_bytes) : probeImageFile(m_path);
+        return m_info;
+    }
+
+    std::shared_ptr<const Image> ImageHandle::getImage() {
+        std::lock_guard lock(m_mutex);
+        if (!m_decodeAttempted) {
+            m_decodeAttempted = true;
+            if (auto bytes = this->takeBytesLocked()) {
+                if (auto image = decodeImage(*bytes)) {
+                    m_image = std::make_shared<const Image>(std::move(*image));
+                }
+            }
+        }
+        return m_image;
+    }
+
+    ImageHandle::GridEntry* ImageHandle::loadGridLocked(int step, SampleMode mode) {
+        auto it = std::find_if(m_grids.begin(), m_grids.end(), [&](GridEntry const& entry) {
+            return entry.step == step && entry.mode == mode;
+        });
+        if (it != m_grids.end()) {
+            std::rotate(m_grids.begin(), it, it + 1);
+            return &m_grids.front();
+        }
+
+        std::optional<SampleGrid> grid;
+        if (m_image) grid = mode == SampleMode::Average ? averageGrid(*m_image, step) : sampleGrid(*m_image, step);
+        else if (auto bytes = this->takeBytesLocked()) grid = decodeSampled(*bytes, step, mode);
+        if (!grid) return nullptr;
+
+        m_grids.insert(m_grids.begin(), { step, mode, std::make_shared<const SampleGrid>(std::move(*grid)), nullptr });
+        this->trimGridsLocked();
+        return &m_grids.front();
+    }
+
+    void ImageHandle::trimGridsLocked() {
+        size_t bytes = 0;
+        for (size_t i = 0; i < m_grids.size(); i++) {
+            auto const& entry = m_grids[i];
+            bytes += entry.grid->cells.size() * sizeof(uint32_t) + (entry.integral ? entry.integral->getByteSize() : 0);
+            if (i > 0 && bytes > kCacheBytes) {
+                m_grids.resize(i);
+                return;
+            }
+        }
+    }
+
+    std::shared_ptr<const SampleGrid> ImageHandle::getSampleGrid(int step, SampleMode mode) {
+        std::lock_guard lock(m_mutex);
+        auto entry = this->loadGridLocked(step, mode);
+        return entry ? entry->grid : nullptr;
+    }
+
+    std::shared_ptr<const IntegralImage> ImageHandle::getIntegralImage(int step, SampleMode mode) {
+        std::lock_guard lock(m_mutex);
+        auto entry = this->loadGridLocked(step, mode);
+        if (!entry) return nullptr;
+        if (!entry->integral) {
+            entry->integral = std::make_shared<const IntegralImage>(*entry->grid);
+            this->trimGridsLocked();
+        }
+        return entry->integral;
+    }
+
+    std::shared_ptr<ImageHandle> openImage(std::filesystem::path const& path) {
+        static std::mutex cacheMutex;
+        static std::unordered_map<std::string, std::weak_ptr<ImageHandle>> cache;
+
+        std::error_code ec;
+        auto mtime = std::filesystem::last_write_time(path, ec);
+        auto key = path.string();
+
+        std::lock_guard lock(cacheMutex);
+        std::erase_if(cache, [](auto const& entry) { return entry.second.expired(); });
+
+        if (auto it = cache.find(key); it != cache.end()) {
+            if (auto handle = it->second.lock(); handle && handle->getModifiedTime() == mtime) return handle;
+        }
+
+        auto handle = std::make_shared<ImageHandle>(path, mtime);
+        cache[key] = handle;
+        return handle;
+    }
+}
@@ -0,0 +1,83 @@
+#include <itb/IntegralImage.hpp>
+
+namespace itb {
+    double RegionStats::variance() const {
+        if (!area) return 0.0;
+        double n = area;
+        double meanSquares = 0.0;
+        for (int c = 0; c < 3; c++) meanSquares += (sum[c] / n) * (sum[c] / n);
+        double result = sumSquares / n - meanSquares;
+        return result > 0.0 ? result : 0.0;
+    }
+
+    bool RegionStats::isUniform() const {
+        if (area <= 1) return true;
+        // n * sum(x^2) == sum(x)^2 per channel; exact in 64 bits below 4M cells.
+        if (area < (1 << 22)) {
+            uint64_t squaredSums = 0;
+            for (int c = 0; c < 3; c++) squaredSums += sum[c] * sum[c];
+            return sumSquares * uint64_t(area) == squaredSums;
+        }
+        return this->variance() < 1e-6;
+    }
+
+    uint32_t RegionStats::meanColor() const {
+        if (!area) return 0;
+        auto channel = [&](int c) { return uint32_t((sum[c] + area / 2) / area); };
+        return packRGBA(channel(0), channel(1), channel(2), channel(3));
+    }
+
+    IntegralImage::IntegralImage(SampleGrid const& grid, int alphaThreshold)
+        : m_width(grid.width), m_height(grid.height) {
+        size_t stride = size_t(m_width) + 1;
+        size_t size = stride * (size_t(m_height) + 1);
+        for (auto& table : m_sums) table.assign(size, 0);
+        m_opaque.assign(size, 0);
+        m_squares.assign(size, 0);
+
+        for (int y = 0; y < m_height; y++) {
+            uint32_t rowSums[4] = {};
+            uint32_t rowOpaque = 0;
+            uint64_t rowSquares = 0;
+            uint32_t const* cells = &grid.cells[size_t(y) * m_width];
+            size_t above = size_t(y) * stride + 1, here = above + stride;
+
+            for (int x = 0; x < m_width; x++) {
+                uint32_t cell = cells[x];
+                uint32_t r = cellRed(cell), g = cellGreen(cell), b = cellBlue(cell), a = cellAlpha(cell);
+                rowSums[0] += r;
+                rowSums[1] += g;
+                rowSums[2] += b;
+                rowSums[3] += a;
+                rowOpaque += a >= uint32_t(alphaThreshold);
+                rowSquares += r * r + g * g + b * b;
+
+                for (int c = 0; c < 4; c++) m_sums[c][here + x] = m_sums[c][above + x] + rowSums[c];
+                m_opaque[here + x] = m_opaque[above + x] + rowOpaque;
+                m_squares[here + x] = m_squares[above + x] + rowSquares;
+            }
+        }
+    }
+
+    size_t IntegralImage::getByteSize() const {
+        size_t bytes = m_opaque.size() * sizeof(uint32_t) + m_squares.size() * sizeof(uint64_t);
+        for (auto const& sums : m_sums) bytes += sums.size() * sizeof(uint32_t);
+        return bytes;
+    }
+
+    RegionStats IntegralImage::query(int x, int y, int w, int h) const {
+        size_t stride = size_t(m_width) + 1;
+        size_t topLeft = size_t(y) * stride + x, topRight = topLeft + w;
+        size_t bottomLeft = topLeft + size_t(h) * stride, bottomRight = bottomLeft + w;
+
+        RegionStats stats;
+        stats.area = w * h;
+        for (int c = 0; c < 4; c++) {
+            auto const& t = m_sums[c];
+            stats.sum[c] = uint32_t(t[bottomRight] - t[topRight] - t[bottomLeft] + t[topLeft]);
+        }
+        stats.opaque = int(m_opaque[bottomRight] - m_opaque[topRight] - m_opaque[bottomLeft] + m_opaque[topLeft]);
+        stats.sumSquares = m_squares[bottomRight] - m_squares[topRight] - m_squares[bottomLeft] + m_squares[topLeft];
+        return stats;
+    }
+}
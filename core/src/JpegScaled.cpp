@@ -0,0 +1,557 @@
+#include "JpegScaled.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace itb {
+    namespace {
+        constexpr int ZigZag[64] = {
+             0,  1,  8, 16,  9,  2,  3, 10,
+            17, 24, 32, 25, 18, 11,  4,  5,
+            12, 19, 26, 33, 40, 48, 41, 34,
+            27, 20, 13,  6,  7, 14, 21, 28,
+            35, 42, 49, 56, 57, 50, 43, 36,
+            29, 22, 15, 23, 30, 37, 44, 51,
+            58, 59, 52, 45, 38, 31, 39, 46,
+            53, 60, 61, 54, 47, 55, 62, 63
+        };
+
+        // MSB-first entropy-coded segment reader. Stuffed 0xFF00 bytes are unescaped; any other marker
+        // stops the stream and feeds zeros until the decoder resynchronises at a restart marker.
+        class JpegBits {
+        public:
+            JpegBits(std::span<const unsigned char> data, size_t pos) : m_data(data), m_pos(pos) {}
+
+            uint32_t peek(int n) {
+                if (m_count < n) this->fill();
+                return uint32_t(m_bits >> (64 - n));
+            }
+
+            void drop(int n) {
+                m_bits <<= n;
+                m_count -= n;
+            }
+
+            int take(int n) {
+                if (n == 0) return 0;
+                uint32_t value = this->peek(n);
+                this->drop(n);
+                return int(value);
+            }
+
+            int extend(int n) {
+                int value = this->take(n);
+                return value < (1 << (n - 1)) ? value - (1 << n) + 1 : value;
+            }
+
+            bool restart() {
+                m_bits = 0;
+                m_count = 0;
+                m_hitMarker = false;
+                while (m_pos + 1 < m_data.size() && m_data[m_pos] == 0xFF && m_data[m_pos + 1] == 0xFF) m_pos++;
+                if (m_pos + 1 >= m_data.size() || m_data[m_pos] != 0xFF) return false;
+                if (m_data[m_pos + 1] < 0xD0 || m_data[m_pos + 1] > 0xD7) return false;
+                m_pos += 2;
+                return true;
+            }
+
+        private:
+            std::span<const unsigned char> m_data;
+            size_t m_pos;
+            uint64_t m_bits = 0;
+            int m_count = 0;
+            bool m_hitMarker = false;
+
+            void fill() {
+                while (m_count <= 56) {
+                    uint64_t byte = 0;
+                    if (!m_hitMarker && m_pos < m_data.size()) {
+                        byte = m_data[m_pos];
+                        if (byte == 0xFF) {
+                            unsigned next = m_pos + 1 < m_data.size() ? m_data[m_pos + 1] : 0xD9;
+                            if (next == 0) m_pos += 2;
+                            else {
+                                m_hitMarker = true;
+                                byte = 0;
+                            }
+                        }
+                        else m_pos++;
+                    }
+                    m_bits |= byte << (56 - m_count);
+                    m_count += 8;
+                }
+            }
+        };
+
+        class JpegHuffman {
+        public:
+            static constexpr int FastBits = 9;
+
+            JpegHuffman() {
+                std::fill(std::begin(m_fast), std::end(m_fast), int16_t(-1));
+                m_maxCode[17] = 0xffffffff;
+            }
+
+            bool build(unsigned char const* counts, unsigned char const* symbols, int symbolCount) {
+                std::fill(std::begin(m_fast), std::end(m_fast), int16_t(-1));
+                m_symbolCount = symbolCount;
+                std::memcpy(m_values, symbols, symbolCount);
+
+                int code = 0, k = 0;
+                for (int length = 1; length <= 16; length++) {
+                    m_delta[length] = k - code;
+                    for (int i = 0; i < counts[length - 1]; i++) {
+                        m_sizes[k] = uint8_t(length);
+                        m_codes[k] = uint16_t(code);
+                        k++;
+                        code++;
+                    }
+                    if (code > (1 << length)) return false;
+                    m_maxCode[length] = uint32_t(code) << (16 - length);
+                    code <<= 1;
+                }
+                m_maxCode[17] = 0xffffffff;
+
+                for (int i = 0; i < k; i++) {
+                    int size = m_sizes[i];
+                    if (size > FastBits) continue;
+                    int first = m_codes[i] << (FastBits - size);
+                    for (int j = 0; j < (1 << (FastBits - size)); j++) m_fast[first + j] = int16_t(i);
+                }
+                return true;
+            }
+
+            int decode(JpegBits& bits) const {
+                int k = m_fast[bits.peek(FastBits)];
+                if (k >= 0) {
+                    bits.drop(m_sizes[k]);
+                    return m_values[k];
+                }
+
+                uint32_t window = bits.peek(16);
+                int length = FastBits + 1;
+                while (window >= m_maxCode[length]) length++;
+                if (length > 16) return -1;
+                int index = int(window >> (16 - length)) + m_delta[length];
+                if (index < 0 || index >= m_symbolCount) return -1;
+                bits.drop(length);
+                return m_values[index];
+            }
+
+        private:
+            int16_t m_fast[1 << FastBits];
+            uint8_t m_sizes[256];
+            uint16_t m_codes[256];
+            unsigned char m_values[256];
+            int m_delta[17] = {};
+            uint32_t m_maxCode[18] = {};
+            int m_symbolCount = 0;
+        };
+
+        // t[x][u] = mean over the 8/N pixels p of output x of C(u)/2 * cos((2p+1)u*pi / 16): the 8-point
+        // IDCT basis box-filtered down to N outputs, so every output is exactly the mean of the pixels
+        // it covers in the full decode. Each axis has its own N, so subsampled components can be
+        // reconstructed at their own sample rate.
+        struct ReducedIdct {
+            int width = 1, height = 1;
+            float basisX[8][8];
+            float basisY[8][8];
+
+            ReducedIdct() = default;
+            ReducedIdct(int w, int h) : width(w), height(h) {
+                fillBasis(basisX, w);
+                fillBasis(basisY, h);
+            }
+
+            static void fillBasis(float (&basis)[8][8], int n) {
+                int span = 8 / n;
+                for (int x = 0; x < n; x++) {
+                    for (int u = 0; u < 8; u++) {
+                        float c = u == 0 ? 1.0f / std::sqrt(2.0f) : 1.0f;
+                        float sum = 0;
+                        for (int p = x * span; p < (x + 1) * span; p++) sum += std::cos((2 * p + 1) * u * 3.14159265358979f / 16);
+                        basis[x][u] = 0.5f * c * sum / span;
+                    }
+                }
+            }
+
+            // `lastU` and `lastV` bound the nonzero coefficients; most blocks only have a few low ones.
+            void run(int const* coeffs, int lastU, int lastV, unsigned char* out, int stride) const {
+                if (lastU == 0 && lastV == 0) {
+                    unsigned char flat = clamp(coeffs[0] / 8.0f + 128.0f);
+                    for (int y = 0; y < height; y++) std::fill_n(out + y * stride, width, flat);
+                    return;
+                }
+
+                float rows[8][8];
+                for (int v = 0; v <= lastV; v++) {
+                    for (int x = 0; x < width; x++) {
+                        float sum = 0;
+                        for (int u = 0; u <= lastU; u++) sum += basisX[x][u] * coeffs[v * 8 + u];
+                        rows[v][x] = sum;
+                    }
+                }
+                for (int y = 0; y < height; y++) {
+                    for (int x = 0; x < width; x++) {
+                        float sum = 0;
+                        for (int v = 0; v <= lastV; v++) sum += basisY[y][v] * rows[v][x];
+                        out[y * stride + x] = clamp(sum + 128.0f);
+                    }
+                }
+            }
+
+            static unsigned char clamp(float value) {
+                return uint8_t(std::clamp(int(value + 0.5f), 0, 255));
+            }
+        };
+
+        struct Component {
+            int id = 0;
+            int h = 1, v = 1;
+            int quant = 0;
+            int dcTable = 0, acTable = 0;
+            int dcPred = 0;
+            // Samples each block is reconstructed at, and the IDCT that does it.
+            int blockWidth = 1, blockHeight = 1;
+            ReducedIdct idct;
+            int planeWidth = 0;
+            std::vector<unsigned char> plane;
+            // Components subsampled across decode each row of MCUs here first, and only keep it in
+            // `plane` once it's reduced to the image's width.
+            int stripWidth = 0;
+            std::vector<unsigned char> strip;
+        };
+
+        class JpegDecoder {
+        public:
+            JpegDecoder(std::span<const unsigned char> data, int scale)
+                : m_data(data), m_scale(scale), m_blockSize(8 / scale) {}
+
+            std::optional<Image> decode() {
+                if (m_data.size() < 4 || m_data[0] != 0xFF || m_data[1] != 0xD8) return std::nullopt;
+                m_pos = 2;
+
+                for (;;) {
+                    int marker = this->nextMarker();
+                    if (marker < 0) return std::nullopt;
+
+                    if (marker == 0xD8 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+                    if (marker == 0xD9) return std::nullopt;
+
+                    if (m_pos + 2 > m_data.size()) return std::nullopt;
+                    size_t length = (size_t(m_data[m_pos]) << 8) | m_data[m_pos + 1];
+                    if (length < 2 || m_pos + length > m_data.size()) return std::nullopt;
+                    std::span<const unsigned char> segment = m_data.subspan(m_pos + 2, length - 2);
+                    m_pos += length;
+
+                    bool ok = true;
+                    switch (marker) {
+                        case 0xDB: ok = this->readQuantTables(segment); break;
+                        case 0xC4: ok = this->readHuffmanTables(segment); break;
+                        case 0xDD: ok = segment.size() >= 2; if (ok) m_restartInterval = (segment[0] << 8) | segment[1]; break;
+                        case 0xC0: case 0xC1: ok = this->readFrame(segment); break;
+                        case 0xE0: if (segment.size() >= 5 && !std::memcmp(segment.data(), "JFIF", 5)) m_jfif = true; break;
+                        case 0xEE:
+                            if (segment.size() >= 12 && !std::memcmp(segment.data(), "Adobe", 5)) m_adobeTransform = segment[11];
+                            break;
+                        case 0xDA: return this->readScan(segment);
+                        default:
+                            // Progressive, lossless, hierarchical and arithmetic-coded frames.
+                            if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) return std::nullopt;
+                            break;
+                    }
+                    if (!ok) return std::nullopt;
+                }
+            }
+
+        private:
+            std::span<const unsigned char> m_data;
+            size_t m_pos = 0;
+            int m_scale;
+            int m_blockSize;
+
+            uint16_t m_quant[4][64] = {};
+            JpegHuffman m_dc[4], m_ac[4];
+            int m_restartInterval = 0;
+            bool m_jfif = false;
+            int m_adobeTransform = -1;
+
+            int m_width = 0, m_height = 0;
+            int m_maxH = 1, m_maxV = 1;
+            std::vector<Component> m_components;
+
+            int nextMarker() {
+                while (m_pos < m_data.size() && m_data[m_pos] != 0xFF) m_pos++;
+                while (m_pos < m_data.size() && m_data[m_pos] == 0xFF) m_pos++;
+                if (m_pos >= m_data.size()) return -1;
+                return m_data[m_pos++];
+            }
+
+            bool readQuantTables(std::span<const unsigned char> s) {
+                size_t i = 0;
+                while (i < s.size()) {
+                    int precision = s[i] >> 4, id = s[i] & 15;
+                    i++;
+                    if (id > 3 || precision > 1) return false;
+                    if (i + 64 * (precision + 1) > s.size()) return false;
+                    for (int k = 0; k < 64; k++) {
+                        m_quant[id][k] = precision ? uint16_t((s[i] << 8) | s[i + 1]) : s[i];
+                        i += precision + 1;
+                    }
+                }
+                return true;
+            }
+
+            bool readHuffmanTables(std::span<const unsigned char> s) {
+                size_t i = 0;
+                while (i + 17 <= s.size()) {
+                    int tableClass = s[i] >> 4, id = s[i] & 15;
+                    if (tableClass > 1 || id > 3) return false;
+                    unsigned char const* counts = &s[i + 1];
+                    int total = 0;
+                    for (int k = 0; k < 16; k++) total += counts[k];
+                    i += 17;
+                    if (total > 256 || i + total > s.size()) return false;
+                    auto& table = tableClass ? m_ac[id] : m_dc[id];
+                    if (!table.build(counts, &s[i], total)) return false;
+                    i += total;
+                }
+                return i == s.size();
+            }
+
+            bool readFrame(std::span<const unsigned char> s) {
+                if (s.size() < 6 || s[0] != 8) return false;
+                m_height = (s[1] << 8) | s[2];
+                m_width = (s[3] << 8) | s[4];
+                int count = s[5];
+                if (!m_width || !m_height || (count != 1 && count != 3)) return false;
+                if (s.size() < size_t(6 + count * 3)) return false;
+
+                m_components.resize(count);
+                for (int i = 0; i < count; i++) {
+                    auto& c = m_components[i];
+                    c.id = s[6 + i * 3];
+                    c.h = s[7 + i * 3] >> 4;
+                    c.v = s[7 + i * 3] & 15;
+                    c.quant = s[8 + i * 3];
+                    if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4 || c.quant > 3) return false;
+                }
+                // A single-component frame is always coded one block per MCU, whatever it declares.
+                if (count == 1) m_components[0].h = m_components[0].v = 1;
+
+                for (auto const& c : m_components) {
+                    m_maxH = std::max(m_maxH, c.h);
+                    m_maxV = std::max(m_maxV, c.v);
+                }
+                // Axes subsampled 2x are reconstructed at every sample, so downsampleHalved can fold stb's
+                // upsampling filter into the reduction; stb uses nearest neighbour for other ratios, so
+                // those files are left to it.
+                for (auto& c : m_components) {
+                    if ((m_maxH != c.h && m_maxH != 2 * c.h) || (m_maxV != c.v && m_maxV != 2 * c.v)) return false;
+                    c.blockWidth = c.h == m_maxH ? m_blockSize : 8;
+                    c.blockHeight = c.v == m_maxV ? m_blockSize : 8;
+                    c.idct = ReducedIdct(c.blockWidth, c.blockHeight);
+                }
+                return true;
+            }
+
+            bool decodeBlock(JpegBits& bits, Component& c, unsigned char* out, int stride) {
+                int coeffs[64];
+                std::fill(std::begin(coeffs), std::end(coeffs), 0);
+                uint16_t const* quant = m_quant[c.quant];
+
+                int size = m_dc[c.dcTable].decode(bits);
+                if (size < 0 || size > 11) return false;
+                c.dcPred += size ? bits.extend(size) : 0;
+                coeffs[0] = c.dcPred * quant[0];
+
+                auto const& ac = m_ac[c.acTable];
+                int lastU = 0, lastV = 0;
+                for (int k = 1; k < 64;) {
+                    int rs = ac.decode(bits);
+                    if (rs < 0) return false;
+                    int run = rs >> 4, bitCount = rs & 15;
+                    if (!bitCount) {
+                        if (run != 15) break;
+                        k += 16;
+                        continue;
+                    }
+                    k += run;
+                    if (k > 63) return false;
+                    int natural = ZigZag[k];
+                    coeffs[natural] = bits.extend(bitCount) * quant[k];
+                    lastU = std::max(lastU, natural & 7);
+                    lastV = std::max(lastV, natural >> 3);
+                    k++;
+                }
+
+                c.idct.run(coeffs, lastU, lastV, out, stride);
+                return true;
+            }
+
+            std::optional<Image> readScan(std::span<const unsigned char> s) {
+                if (m_components.empty() || s.empty()) return std::nullopt;
+                int count = s[0];
+                // Baseline files with separate per-component scans are rare enough to leave to stb.
+                if (count != int(m_components.size()) || s.size() < size_t(1 + count * 2 + 3)) return std::nullopt;
+                for (int i = 0; i < count; i++) {
+                    int id = s[1 + i * 2];
+                    auto it = std::find_if(m_components.begin(), m_components.end(), [&](auto const& c) { return c.id == id; });
+                    if (it == m_components.end() || &*it != &m_components[i]) return std::nullopt;
+                    it->dcTable = s[2 + i * 2] >> 4;
+                    it->acTable = s[2 + i * 2] & 15;
+                    if (it->dcTable > 3 || it->acTable > 3) return std::nullopt;
+                }
+
+                int mcuWidth = 8 * m_maxH, mcuHeight = 8 * m_maxV;
+                int mcusX = (m_width + mcuWidth - 1) / mcuWidth;
+                int mcusY = (m_height + mcuHeight - 1) / mcuHeight;
+                int width = (m_width + m_scale - 1) / m_scale;
+                for (auto& c : m_components) {
+                    int decodedWidth = mcusX * c.h * c.blockWidth;
+                    c.planeWidth = c.h == m_maxH ? decodedWidth : width;
+                    c.plane.assign(size_t(c.planeWidth) * mcusY * c.v * c.blockHeight, 0);
+                    if (c.h != m_maxH) {
+                        c.stripWidth = decodedWidth;
+                        c.strip.assign(size_t(decodedWidth) * c.v * c.blockHeight, 0);
+                    }
+                }
+
+                JpegBits bits(m_data, m_pos);
+                int untilRestart = m_restartInterval;
+                for (int my = 0; my < mcusY; my++) {
+                    for (int mx = 0; mx < mcusX; mx++) {
+                        if (m_restartInterval && untilRestart-- == 0) {
+                            if (!bits.restart()) return std::nullopt;
+                            for (auto& c : m_components) c.dcPred = 0;
+                            untilRestart = m_restartInterval - 1;
+                        }
+                        for (auto& c : m_components) {
+                            bool stripped = !c.strip.empty();
+                            int stride = stripped ? c.stripWidth : c.planeWidth;
+                            unsigned char* row = stripped ? c.strip.data() : &c.plane[size_t(my) * c.v * c.blockHeight * stride];
+                            for (int by = 0; by < c.v; by++) {
+                                for (int bx = 0; bx < c.h; bx++) {
+                                    unsigned char* out = row + size_t(by) * c.blockHeight * stride + size_t(mx * c.h + bx) * c.blockWidth;
+                                    if (!this->decodeBlock(bits, c, out, stride)) return std::nullopt;
+                                }
+                            }
+                        }
+                    }
+                    for (auto& c : m_components) {
+                        if (!c.strip.empty()) this->reduceAcross(c, my);
+                    }
+                }
+                for (auto& c : m_components) {
+                    if (c.v != m_maxV) this->reduceDown(c);
+                }
+                return this->assemble();
+            }
+
+            // Components subsampled 2x along an axis are decoded at every sample and reduced to the
+            // image's size here. stb_image upsamples them with a triangle filter (3/4 of the nearest
+            // sample, 1/4 of the next one out) before the full image is box-filtered, so each output is
+            // the mean of its samples, less a quarter of each edge sample's weight that spills into the
+            // neighbouring cell, plus the quarter that spills in from the neighbour's edge sample.
+            // Cells are summed 8x over and `shift` divides by 8 x span, a power of two; edges are clamped
+            // as stb clamps them. Widths and shifts are kept in locals, as the byte stores could alias
+            // members.
+            static uint8_t reduceCell(int weighted, int firstInside, int lastInside, int before, int after, int shift) {
+                int value = (weighted - firstInside - lastInside + before + after + (1 << (shift - 1))) >> shift;
+                return uint8_t(std::min(value, 255));
+            }
+
+            // Reduces MCU row `my` of a component subsampled across from its strip into `plane`.
+            void reduceAcross(Component& c, int my) const {
+                int span = m_scale / 2, samples = (m_width + 1) / 2, shift = std::countr_zero(unsigned(m_scale)) + 2;
+                int width = c.planeWidth, stripWidth = c.stripWidth;
+                int rows = int(c.strip.size() / stripWidth);
+                std::vector<unsigned char> line(size_t(width) * span + 2);
+                int copied = std::min(samples, int(line.size()) - 1);
+                for (int y = 0; y < rows; y++) {
+                    unsigned char const* in = &c.strip[size_t(y) * stripWidth];
+                    line[0] = in[0];
+                    std::copy_n(in, copied, line.begin() + 1);
+                    std::fill(line.begin() + 1 + copied, line.end(), in[samples - 1]);
+                    unsigned char* out = &c.plane[(size_t(my) * rows + y) * width];
+                    for (int x = 0; x < width; x++) {
+                        unsigned char const* cell = &line[1 + size_t(x) * span];
+                        int sum = 0;
+                        for (int j = 0; j < span; j++) sum += cell[j];
+                        out[x] = reduceCell(8 * sum, cell[0], cell[span - 1], cell[-1], cell[span], shift);
+                    }
+                }
+            }
+
+            // Reduces a component subsampled down its height, once every row is decoded.
+            void reduceDown(Component& c) const {
+                int span = m_scale / 2, samples = (m_height + 1) / 2, shift = std::countr_zero(unsigned(m_scale)) + 2;
+                int width = c.planeWidth, height = (m_height + m_scale - 1) / m_scale;
+                unsigned char const* in = c.plane.data();
+                auto row = [&](int j) { return in + size_t(std::clamp(j, 0, samples - 1)) * width; };
+                std::vector<int> weighted(width);
+                std::vector<unsigned char> plane(size_t(width) * height);
+                for (int y = 0; y < height; y++) {
+                    int first = y * span, last = first + span - 1;
+                    std::fill(weighted.begin(), weighted.end(), 0);
+                    for (int j = first; j <= last; j++) {
+                        unsigned char const* samplesRow = row(j);
+                        for (int x = 0; x < width; x++) weighted[x] += 8 * samplesRow[x];
+                    }
+                    unsigned char const *top = row(first), *bottom = row(last), *above = row(first - 1), *below = row(last + 1);
+                    unsigned char* out = &plane[size_t(y) * width];
+                    for (int x = 0; x < width; x++) out[x] = reduceCell(weighted[x], top[x], bottom[x], above[x], below[x], shift);
+                }
+                c.plane = std::move(plane);
+            }
+
+            Image assemble() const {
+                Image image;
+                image.width = (m_width + m_scale - 1) / m_scale;
+                image.height = (m_height + m_scale - 1) / m_scale;
+                image.pixels.resize(size_t(image.width) * image.height * 4);
+
+                bool rgb = false;
+                if (m_components.size() == 3) {
+                    rgb = (m_components[0].id == 'R' && m_components[1].id == 'G' && m_components[2].id == 'B')
+                        || (m_adobeTransform == 0 && !m_jfif);
+                }
+
+                // Every plane is already at the image's size.
+                size_t count = m_components.size();
+                for (int y = 0; y < image.height; y++) {
+                    unsigned char const* rows[3] = {};
+                    for (size_t i = 0; i < count; i++) rows[i] = &m_components[i].plane[size_t(y) * m_components[i].planeWidth];
+
+                    unsigned char* out = &image.pixels[size_t(y) * image.width * 4];
+                    for (int x = 0; x < image.width; x++, out += 4) {
+                        if (count == 1) out[0] = out[1] = out[2] = rows[0][x];
+                        else if (rgb) {
+                            out[0] = rows[0][x];
+                            out[1] = rows[1][x];
+                            out[2] = rows[2][x];
+                        }
+                        else {
+                            float luma = rows[0][x];
+                            float cb = rows[1][x] - 128.0f, cr = rows[2][x] - 128.0f;
+                            out[0] = ReducedIdct::clamp(luma + 1.402f * cr);
+                            out[1] = ReducedIdct::clamp(luma - 0.344136f * cb - 0.714136f * cr);
+                            out[2] = ReducedIdct::clamp(luma + 1.772f * cb);
+                        }
+                        out[3] = 255;
+                    }
+                }
+                return image;
+            }
+        };
+    }
+
+    std::optional<Image> decodeJpegScaled(std::span<const unsigned char> data, int scale) {
+        if (scale != 2 && scale != 4 && scale != 8) return std::nullopt;
+        return JpegDecoder(data, scale).decode();
+    }
+}
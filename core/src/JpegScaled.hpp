@@ -0,0 +1,16 @@
+#pragma once
+
+#include <itb/Image.hpp>
+
+#include <optional>
+#include <span>
+
+namespace itb {
+    // Decodes a baseline JPEG at 1/scale resolution (scale 2, 4 or 8) with an IDCT whose outputs are
+    // box averages of the full-size one; at 1/8 only the DC term is used for unsubsampled planes.
+    // Planes subsampled 2x are reduced as stb_image would upsample them, so the result matches a box
+    // filter of stb's full decode. The result is ceil(w/scale) x ceil(h/scale). Progressive,
+    // arithmetic-coded, 12-bit and CMYK files, and other subsampling ratios, return nullopt so callers
+    // can fall back to stb.
+    std::optional<Image> decodeJpegScaled(std::span<const unsigned char> data, int scale);
+}
@@ -0,0 +1,57 @@
+#include "MatchPolicy.hpp"
+#include "MergeStrategies.hpp"
+#include "RectCover.hpp"
+
+namespace itb {
+    namespace {
+        // Labels 4-connected regions of opaque cells within tolerance of the region's first cell in
+        // row-major order, so every cell of a region matches its seed and no region drifts along a
+        // gradient. Labels count up from 0 in seed order; transparent cells get -1. Returns each
+        // region's seed cell index. Stops early, leaving cells unlabelled, once `cancel` fires.
+        template <class Policy>
+        std::vector<int> labelRegions(SampleGrid const& grid, Policy const& policy, CancelToken const& cancel, std::vector<int>& labels) {
+            int gW = grid.width, gH = grid.height;
+            std::vector<int> seeds;
+            std::vector<int> queue;
+            labels.assign(gW * gH, -1);
+
+            for (int start = 0; start < gW * gH; start++) {
+                if (start % gW == 0 && cancel.cancelled()) break;
+                if (labels[start] >= 0 || cellAlpha(grid.cells[start]) < 200) continue;
+                int label = int(seeds.size());
+                seeds.push_back(start);
+                labels[start] = label;
+                queue.assign(1, start);
+
+                for (size_t head = 0; head < queue.size(); head++) {
+                    // One region can be most of the grid, so the poll runs inside the fill as well.
+                    if (head % 65536 == 65535 && cancel.cancelled()) return seeds;
+                    int idx = queue[head];
+                    int x = idx % gW;
+                    int neighbours[4] = { x > 0 ? idx - 1 : -1, x + 1 < gW ? idx + 1 : -1, idx - gW, idx + gW < gW * gH ? idx + gW : -1 };
+                    for (int n : neighbours) {
+                        if (n < 0 || labels[n] >= 0) continue;
+                        if (!policy.matches(n, start)) continue;
+                        labels[n] = label;
+                        queue.push_back(n);
+                    }
+                }
+            }
+            return seeds;
+        }
+    }
+
+    std::vector<MergeRect> LargestFirstMerge::merge(SampleGrid const& grid, IntegralImage const&, MergeParams const& params) const {
+        int gW = grid.width, gH = grid.height;
+
+        std::vector<int> keys;
+        auto seeds = withMatchPolicy(grid, params.metric, params.tolerance, [&](auto const& policy) {
+            return labelRegions(grid, policy, params.cancel, keys);
+        });
+
+        std::vector<MergeRect> rects;
+        coverLabels(keys, gW, 0, 0, gW, gH, -1, params.maxSpan, params.cancel, rects);
+        for (auto& rect : rects) rect.color = grid.cells[seeds[keys[rect.y * gW + rect.x]]];
+        return rects;
+    }
+}
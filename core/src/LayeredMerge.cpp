@@ -0,0 +1,106 @@
+#include <itb/Merge.hpp>
+
+#include "CoverageMap.hpp"
+#include "MatchPolicy.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace itb {
+    namespace {
+        // First remaining opaque cell of the most common exact RGB, or -1 if none is left.
+        int findLayerBase(SampleGrid const& grid, std::vector<int> const& layerOf) {
+            struct Tally { int count; int first; };
+            std::unordered_map<uint32_t, Tally> tallies;
+            for (size_t i = 0; i < grid.cells.size(); i++) {
+                uint32_t cell = grid.cells[i];
+                if (layerOf[i] >= 0 || cell < kOpaqueWord) continue;
+                tallies.try_emplace(cell & 0xFFFFFF, Tally{ 0, int(i) }).first->second.count++;
+            }
+            // Ties go to the colour seen first, so the choice doesn't depend on hash order.
+            Tally best{ 0, -1 };
+            for (auto const& [rgb, tally] : tallies) {
+                if (tally.count > best.count || (tally.count == best.count && tally.first < best.first)) best = tally;
+            }
+            return best.first;
+        }
+
+        // Covers every cell of layer `z` with blocks of `color` that may also run over any cell not
+        // marked in `blocked`: those belong to later layers and get painted over. Blocks of one layer
+        // may overlap each other, as they share a colour.
+        void coverLayer(std::vector<int> const& layerOf, int gW, int gH, int z, uint32_t color,
+            CoverageMap const& blocked, int maxSpan, std::vector<MergeRect>& out) {
+            // Set for every cell that doesn't still need this layer's colour.
+            CoverageMap settled(gW, gH);
+            for (int y = 0; y < gH; y++) {
+                for (int x = 0; x < gW; x++) {
+                    if (layerOf[size_t(y) * gW + x] != z) settled.set(x, y);
+                }
+            }
+
+            for (int gy = 0; gy < gH; gy++) {
+                for (int gx = settled.nextClear(gy, 0); gx < gW; gx = settled.nextClear(gy, gx + 1)) {
+                    int end = blocked.nextSet(gy, gx + 1, std::min(gW, gx + maxSpan));
+                    // Trailing cells without work in this row would only shorten the block downwards.
+                    int spX = 1;
+                    for (int x = settled.nextClear(gy, gx + 1); x < end; x = settled.nextClear(gy, x + 1)) spX = x - gx + 1;
+
+                    int spY = 1;
+                    while (gy + spY < gH && spY < maxSpan && blocked.nextSet(gy + spY, gx, gx + spX) == gx + spX) spY++;
+                    while (spY > 1 && settled.nextClear(gy + spY - 1, gx) >= gx + spX) spY--;
+
+                    out.push_back({ gx, gy, spX, spY, color, z });
+                    settled.fillRect(gx, gy, spX, spY);
+                }
+            }
+        }
+    }
+
+    std::vector<MergeRect> mergeLayered(MergeStrategy const& detail, SampleGrid const& grid, IntegralImage const& integral,
+        MergeParams const& params, int layers) {
+        auto best = detail.merge(grid, integral, params);
+        int gW = grid.width, gH = grid.height;
+        if (layers <= 0 || params.maxSpan <= 1) return best;
+
+        // Layer of each cell, or -1 while it's left for the detail merge.
+        std::vector<int> layerOf(grid.cells.size(), -1);
+        CoverageMap blocked(gW, gH);
+        for (int y = 0; y < gH; y++) {
+            for (int x = 0; x < gW; x++) {
+                if (grid.cells[size_t(y) * gW + x] < kOpaqueWord) blocked.set(x, y);
+            }
+        }
+
+        std::vector<MergeRect> background;
+        for (int z = 0; z < layers && !params.cancel.cancelled(); z++) {
+            int base = findLayerBase(grid, layerOf);
+            if (base < 0) break;
+            withMatchPolicy(grid, params.metric, params.tolerance, [&](auto const& policy) {
+                for (size_t i = 0; i < layerOf.size(); i++) {
+                    if (layerOf[i] < 0 && policy.matches(int(i), base)) layerOf[i] = z;
+                }
+            });
+            coverLayer(layerOf, gW, gH, z, grid.cells[base], blocked, params.maxSpan, background);
+
+            // Cells this layer claimed must stay uncovered by the layers drawn above it.
+            for (int y = 0; y < gH; y++) {
+                for (int x = 0; x < gW; x++) {
+                    if (layerOf[size_t(y) * gW + x] == z) blocked.set(x, y);
+                }
+            }
+
+            // Everything left is merged on top, with the claimed cells hidden from it.
+            SampleGrid rest = grid;
+            for (size_t i = 0; i < layerOf.size(); i++) {
+                if (layerOf[i] >= 0) rest.cells[i] = 0;
+            }
+            auto top = detail.merge(rest, detail.usesIntegral(rest) ? IntegralImage(rest) : IntegralImage(), params);
+            // Extra layers only pay off while they save more detail blocks than they add.
+            if (background.size() + top.size() >= best.size()) continue;
+            best = background;
+            for (auto& rect : top) rect.z = z + 1;
+            best.insert(best.end(), top.begin(), top.end());
+        }
+        return best;
+    }
+}
@@ -0,0 +1,145 @@
+#include "MatchPolicy.hpp"
+#include "SimdTargets.hpp"
+
+#include <itb/Simd.hpp>
+
+#include <algorithm>
+#include <bit>
+
+namespace itb {
+    namespace {
+        int exactScanScalar(uint32_t const* cells, int from, int limit, uint32_t base) {
+            uint32_t rgb = base & 0xFFFFFF;
+            while (from < limit && cells[from] >= kOpaqueWord && (cells[from] & 0xFFFFFF) == rgb) from++;
+            return from;
+        }
+
+        int channelScanScalar(uint32_t const* cells, int from, int limit, uint32_t base, int tolerance) {
+            for (; from < limit; from++) {
+                uint32_t c = cells[from];
+                if (c < kOpaqueWord || std::abs(cellRed(c) - cellRed(base)) > tolerance ||
+                    std::abs(cellGreen(c) - cellGreen(base)) > tolerance || std::abs(cellBlue(c) - cellBlue(base)) > tolerance) break;
+            }
+            return from;
+        }
+
+        // Byte lanes of the tolerance for the SIMD kernels: RGB lanes hold it clamped to 255, alpha lanes
+        // hold 255 so the saturating test below never fails on alpha.
+        uint32_t toleranceLanes(int tolerance) {
+            uint32_t t = uint32_t(std::clamp(tolerance, 0, 255));
+            return t | t << 8 | t << 16 | 0xFF000000u;
+        }
+
+#if ITB_X86
+        int exactScanSse2(uint32_t const* cells, int from, int limit, uint32_t base) {
+            __m128i const rgbMask = _mm_set1_epi32(0xFFFFFF), rgb = _mm_set1_epi32(int(base & 0xFFFFFF));
+            __m128i const threshold = _mm_set1_epi32(199);
+            for (; from + 4 <= limit; from += 4) {
+                __m128i v = _mm_loadu_si128((__m128i const*)(cells + from));
+                __m128i ok = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(v, rgbMask), rgb),
+                    _mm_cmpgt_epi32(_mm_srli_epi32(v, 24), threshold));
+                int mask = _mm_movemask_ps(_mm_castsi128_ps(ok));
+                if (mask != 0xF) return from + std::countr_one(unsigned(mask));
+            }
+            return exactScanScalar(cells, from, limit, base);
+        }
+
+        // |cell - base| per byte is the OR of the two saturating differences; subtracting the
+        // tolerance with saturation leaves a zero word exactly when every channel is within it.
+        int channelScanSse2(uint32_t const* cells, int from, int limit, uint32_t base, int tolerance) {
+            __m128i const b = _mm_set1_epi32(int(base)), tol = _mm_set1_epi32(int(toleranceLanes(tolerance)));
+            __m128i const zero = _mm_setzero_si128(), threshold = _mm_set1_epi32(199);
+            for (; from + 4 <= limit; from += 4) {
+                __m128i v = _mm_loadu_si128((__m128i const*)(cells + from));
+                __m128i diff = _mm_or_si128(_mm_subs_epu8(v, b), _mm_subs_epu8(b, v));
+                __m128i ok = _mm_and_si128(_mm_cmpeq_epi32(_mm_subs_epu8(diff, tol), zero),
+                    _mm_cmpgt_epi32(_mm_srli_epi32(v, 24), threshold));
+                int mask = _mm_movemask_ps(_mm_castsi128_ps(ok));
+                if (mask != 0xF) return from + std::countr_one(unsigned(mask));
+            }
+            return channelScanScalar(cells, from, limit, base, tolerance);
+        }
+
+        ITB_TARGET_AVX2 int exactScanAvx2(uint32_t const* cells, int from, int limit, uint32_t base) {
+            __m256i const rgbMask = _mm256_set1_epi32(0xFFFFFF), rgb = _mm256_set1_epi32(int(base & 0xFFFFFF));
+            __m256i const threshold = _mm256_set1_epi32(199);
+            for (; from + 8 <= limit; from += 8) {
+                __m256i v = _mm256_loadu_si256((__m256i const*)(cells + from));
+                __m256i ok = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(v, rgbMask), rgb),
+                    _mm256_cmpgt_epi32(_mm256_srli_epi32(v, 24), threshold));
+                int mask = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+                if (mask != 0xFF) return from + std::countr_one(unsigned(mask));
+            }
+            return exactScanScalar(cells, from, limit, base);
+        }
+
+        ITB_TARGET_AVX2 int channelScanAvx2(uint32_t const* cells, int from, int limit, uint32_t base, int tolerance) {
+            __m256i const b = _mm256_set1_epi32(int(base)), tol = _mm256_set1_epi32(int(toleranceLanes(tolerance)));
+            __m256i const zero = _mm256_setzero_si256(), threshold = _mm256_set1_epi32(199);
+            for (; from + 8 <= limit; from += 8) {
+                __m256i v = _mm256_loadu_si256((__m256i const*)(cells + from));
+                __m256i diff = _mm256_or_si256(_mm256_subs_epu8(v, b), _mm256_subs_epu8(b, v));
+                __m256i ok = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_subs_epu8(diff, tol), zero),
+                    _mm256_cmpgt_epi32(_mm256_srli_epi32(v, 24), threshold));
+                int mask = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+                if (mask != 0xFF) return from + std::countr_one(unsigned(mask));
+            }
+            return channelScanScalar(cells, from, limit, base, tolerance);
+        }
+#endif
+
+#if ITB_NEON
+        int exactScanNeon(uint32_t const* cells, int from, int limit, uint32_t base) {
+            uint32x4_t const rgbMask = vdupq_n_u32(0xFFFFFF), rgb = vdupq_n_u32(base & 0xFFFFFF);
+            uint32x4_t const opaque = vdupq_n_u32(kOpaqueWord);
+            for (; from + 4 <= limit; from += 4) {
+                uint32x4_t v = vld1q_u32(cells + from);
+                uint32x4_t ok = vandq_u32(vceqq_u32(vandq_u32(v, rgbMask), rgb), vcgeq_u32(v, opaque));
+                // Narrow each lane to 16 bits and read all four as one 64-bit mask.
+                uint64_t mask = vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(ok)), 0);
+                if (mask != ~uint64_t(0)) return from + std::countr_one(mask) / 16;
+            }
+            return exactScanScalar(cells, from, limit, base);
+        }
+
+        int channelScanNeon(uint32_t const* cells, int from, int limit, uint32_t base, int tolerance) {
+            uint8x16_t const b = vreinterpretq_u8_u32(vdupq_n_u32(base)), tol = vreinterpretq_u8_u32(vdupq_n_u32(toleranceLanes(tolerance)));
+            uint32x4_t const opaque = vdupq_n_u32(kOpaqueWord);
+            for (; from + 4 <= limit; from += 4) {
+                uint32x4_t v = vld1q_u32(cells + from);
+                uint8x16_t over = vqsubq_u8(vabdq_u8(vreinterpretq_u8_u32(v), b), tol);
+                uint32x4_t ok = vandq_u32(vceqq_u32(vreinterpretq_u32_u8(over), vdupq_n_u32(0)), vcgeq_u32(v, opaque));
+                uint64_t mask = vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(ok)), 0);
+                if (mask != ~uint64_t(0)) return from + std::countr_one(mask) / 16;
+            }
+            return channelScanScalar(cells, from, limit, base, tolerance);
+        }
+#endif
+    }
+
+    ExactScanKernel exactScanKernel() {
+        switch (getSimdLevel()) {
+#if ITB_X86
+            case SimdLevel::AVX2: return exactScanAvx2;
+            case SimdLevel::SSE2: return exactScanSse2;
+#endif
+#if ITB_NEON
+            case SimdLevel::NEON: return exactScanNeon;
+#endif
+            default: return exactScanScalar;
+        }
+    }
+
+    ChannelScanKernel channelScanKernel() {
+        switch (getSimdLevel()) {
+#if ITB_X86
+            case SimdLevel::AVX2: return channelScanAvx2;
+            case SimdLevel::SSE2: return channelScanSse2;
+#endif
+#if ITB_NEON
+            case SimdLevel::NEON: return channelScanNeon;
+#endif
+            default: return channelScanScalar;
+        }
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <itb/Color.hpp>
+#include <itb/IntegralImage.hpp>
+#include <itb/SampleGrid.hpp>
+
+#include <cstdlib>
+#include <optional>
+#include <vector>
+
+namespace itb {
+    // Merge kernels are templated on one of the policies below and instantiated once per merge
+    // through withMatchPolicy, so the per-cell test never branches on metric or tolerance.
+    //
+    // Each policy answers, for two cells of one grid:
+    //   matches(cell, base)         cell is opaque and within tolerance of base
+    //   matchesColor(cell, color)   same against a packed colour that needn't be in the grid
+    //   matchesRange(lo, hi, base)  whether every RGB in the per-channel box [lo, hi] is within
+    //                               tolerance of base, or nullopt if the metric can't tell from it
+    //   runEnd(from, limit, base)   first index in [from, limit) that doesn't match, or limit
+    //   rejectsRow(stats, base)     a cheap proof from integral stats that some cell of a row fails
+
+    // Alpha >= 200 as a single unsigned compare on a packed cell.
+    constexpr uint32_t kOpaqueWord = 200u << 24;
+
+    // Scans packed cells for the first one that isn't opaque with base's exact RGB.
+    using ExactScanKernel = int (*)(uint32_t const* cells, int from, int limit, uint32_t base);
+    ExactScanKernel exactScanKernel();
+
+    // Same for cells within `tolerance` of base on every RGB channel.
+    using ChannelScanKernel = int (*)(uint32_t const* cells, int from, int limit, uint32_t base, int tolerance);
+    ChannelScanKernel channelScanKernel();
+
+    // Tolerance 0: one masked compare of packed words, and runs found with SIMD.
+    class ExactMatch {
+    public:
+        explicit ExactMatch(SampleGrid const& grid) : m_cells(grid.cells.data()), m_scan(exactScanKernel()) {}
+
+        bool matches(int cell, int base) const {
+            return this->matchesColor(cell, m_cells[base]);
+        }
+        bool matchesColor(int cell, uint32_t color) const {
+            uint32_t c = m_cells[cell];
+            return c >= kOpaqueWord && ((c ^ color) & 0xFFFFFF) == 0;
+        }
+        std::optional<bool> matchesRange(uint32_t lo, uint32_t hi, int base) const {
+            return ((lo ^ m_cells[base]) & 0xFFFFFF) == 0 && ((hi ^ m_cells[base]) & 0xFFFFFF) == 0;
+        }
+        int runEnd(int from, int limit, int base) const {
+            return m_scan(m_cells, from, limit, m_cells[base]);
+        }
+        // An opaque row matches only if every cell has the same RGB.
+        bool rejectsRow(RegionStats const& stats, uint32_t) const { return !stats.isUniform(); }
+
+    private:
+        uint32_t const* m_cells;
+        ExactScanKernel m_scan;
+    };
+
+    // Per-channel RGB distance of at most `tolerance`; runs are found with SIMD absolute differences.
+    class ChannelMatch {
+    public:
+        ChannelMatch(SampleGrid const& grid, int tolerance)
+            : m_cells(grid.cells.data()), m_tolerance(tolerance), m_scan(channelScanKernel()) {}
+
+        bool matches(int cell, int base) const {
+            return this->matchesColor(cell, m_cells[base]);
+        }
+        bool matchesColor(int cell, uint32_t b) const {
+            uint32_t a = m_cells[cell];
+            return cellAlpha(a) >= 200 &&
+                std::abs(cellRed(a) - cellRed(b)) <= m_tolerance &&
+                std::abs(cellGreen(a) - cellGreen(b)) <= m_tolerance &&
+                std::abs(cellBlue(a) - cellBlue(b)) <= m_tolerance;
+        }
+        // The box's corners are its farthest points from base on every channel.
+        std::optional<bool> matchesRange(uint32_t lo, uint32_t hi, int base) const {
+            uint32_t b = m_cells[base];
+            for (int c = 0; c < 3; c++) {
+                int value = (b >> (c * 8)) & 0xFF;
+                if (value - int((lo >> (c * 8)) & 0xFF) > m_tolerance || int((hi >> (c * 8)) & 0xFF) - value > m_tolerance) return false;
+            }
+            return true;
+        }
+        int runEnd(int from, int limit, int base) const {
+            return m_scan(m_cells, from, limit, m_cells[base], m_tolerance);
+        }
+        // Every cell within tolerance puts the row mean within tolerance too.
+        bool rejectsRow(RegionStats const& stats, uint32_t base) const {
+            for (int c = 0; c < 3; c++) {
+                int64_t offset = int64_t(stats.sum[c]) - int64_t((base >> (c * 8)) & 0xFF) * stats.area;
+                if (std::abs(offset) > int64_t(m_tolerance) * stats.area) return true;
+            }
+            return false;
+        }
+
+    private:
+        uint32_t const* m_cells;
+        int m_tolerance;
+        ChannelScanKernel m_scan;
+    };
+
+    // CIELAB distance; every cell is converted to Lab once up front.
+    template <ColorMetric Metric>
+    class PerceptualMatch {
+    public:
+        PerceptualMatch(SampleGrid const& grid, int tolerance)
+            : m_cells(grid.cells.data()), m_tolerance(float(tolerance)), m_lab(grid.cells.size()) {
+            for (size_t i = 0; i < m_lab.size(); i++) m_lab[i] = rgbToLab(grid.cells[i]);
+        }
+
+        bool matches(int cell, int base) const {
+            if (cellAlpha(m_cells[cell]) < 200) return false;
+            if constexpr (Metric == ColorMetric::DeltaE2000) return deltaE2000(m_lab[cell], m_lab[base]) <= m_tolerance;
+            else return deltaE76(m_lab[cell], m_lab[base]) <= m_tolerance;
+        }
+        bool matchesColor(int cell, uint32_t color) const {
+            if (cellAlpha(m_cells[cell]) < 200) return false;
+            Lab lab = rgbToLab(color);
+            if constexpr (Metric == ColorMetric::DeltaE2000) return deltaE2000(m_lab[cell], lab) <= m_tolerance;
+            else return deltaE76(m_lab[cell], lab) <= m_tolerance;
+        }
+        // Lab distance isn't monotonic over an RGB box, so callers test the cells themselves.
+        std::optional<bool> matchesRange(uint32_t, uint32_t, int) const { return std::nullopt; }
+        int runEnd(int from, int limit, int base) const {
+            while (from < limit && this->matches(from, base)) from++;
+            return from;
+        }
+        bool rejectsRow(RegionStats const&, uint32_t) const { return false; }
+
+    private:
+        uint32_t const* m_cells;
+        float m_tolerance;
+        std::vector<Lab> m_lab;
+    };
+
+    // Calls fn with the policy for metric and tolerance. Tolerance 0 means identical colours under
+    // every metric, so it always takes the exact policy.
+    template <class Fn>
+    decltype(auto) withMatchPolicy(SampleGrid const& grid, ColorMetric metric, int tolerance, Fn&& fn) {
+        if (tolerance <= 0) return fn(ExactMatch(grid));
+        switch (metric) {
+            case ColorMetric::DeltaE76: return fn(PerceptualMatch<ColorMetric::DeltaE76>(grid, tolerance));
+            case ColorMetric::DeltaE2000: return fn(PerceptualMatch<ColorMetric::DeltaE2000>(grid, tolerance));
+            default: return fn(ChannelMatch(grid, tolerance));
+        }
+    }
+}
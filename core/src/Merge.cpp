@@ -0,0 +1,60 @@
+#include <itb/Merge.hpp>
+
+#include "MergeStrategies.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace itb {
+    std::unique_ptr<MergeStrategy> createMergeStrategy(MergeMode mode) {
+        switch (mode) {
+            case MergeMode::LargestFirst: return std::make_unique<LargestFirstMerge>();
+            case MergeMode::Quadtree: return std::make_unique<QuadtreeMerge>();
+            case MergeMode::ErrorBudget: return std::make_unique<ErrorBudgetMerge>();
+            case MergeMode::Components: return std::make_unique<ComponentMerge>();
+            default: return std::make_unique<GreedyMerge>();
+        }
+    }
+
+    char const* mergeModeName(MergeMode mode) {
+        switch (mode) {
+            case MergeMode::LargestFirst: return "Largest First";
+            case MergeMode::Quadtree: return "Quadtree";
+            case MergeMode::ErrorBudget: return "Error Budget";
+            case MergeMode::Components: return "Components";
+            default: return "Greedy";
+        }
+    }
+
+    double measureMergeError(SampleGrid const& grid, std::vector<MergeRect> const& rects) {
+        // Paints the blocks in z order (stable, so later blocks of a layer win) and compares what shows.
+        std::vector<MergeRect const*> order;
+        order.reserve(rects.size());
+        for (auto const& r : rects) order.push_back(&r);
+        std::stable_sort(order.begin(), order.end(), [](MergeRect const* a, MergeRect const* b) { return a->z < b->z; });
+
+        std::vector<uint32_t> painted(grid.cells.size());
+        std::vector<bool> covered(grid.cells.size(), false);
+        for (auto const* r : order) {
+            for (int y = r->y; y < r->y + r->spanY; y++) {
+                for (int x = r->x; x < r->x + r->spanX; x++) {
+                    size_t i = size_t(y) * grid.width + x;
+                    painted[i] = r->color;
+                    covered[i] = true;
+                }
+            }
+        }
+
+        double total = 0.0;
+        long long count = 0;
+        for (size_t i = 0; i < grid.cells.size(); i++) {
+            if (!covered[i]) continue;
+            for (int c = 0; c < 3; c++) {
+                double d = int((grid.cells[i] >> (c * 8)) & 0xFF) - int((painted[i] >> (c * 8)) & 0xFF);
+                total += d * d;
+            }
+            count++;
+        }
+        return count ? std::sqrt(total / (3.0 * count)) : 0.0;
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <itb/Merge.hpp>
+
+namespace itb {
+    // Largest variance() a Quadtree or ErrorBudget block may have. `tolerance` bounds the RMS error
+    // taken over R, G and B, and variance() sums the three channels.
+    inline double maxBlockVariance(int tolerance) { return 3.0 * tolerance * tolerance; }
+
+    // Row-major scan: from each unclaimed cell, extend right, then down while every new cell is
+    // within tolerance of the starting cell, whose colour the block keeps. Grids over 256 cells on a
+    // side are scanned as 256 x 256 tiles in parallel, and blocks meeting on a seam are fused again.
+    class GreedyMerge : public MergeStrategy {
+    public:
+        MergeMode getMode() const override { return MergeMode::Greedy; }
+        std::vector<MergeRect> merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const override;
+        // Tiled grids build each tile's tables themselves.
+        bool usesIntegral(SampleGrid const& grid) const override;
+    };
+
+    // Labels 4-connected regions of cells within tolerance of each region's first cell, then
+    // repeatedly takes the largest rectangles left inside a region, painted with its first cell's
+    // colour. Each sweep runs the histogram/stack maximal-rectangle search over every row in
+    // O(gW * gH) and keeps the best non-overlapping candidates.
+    class LargestFirstMerge : public MergeStrategy {
+    public:
+        MergeMode getMode() const override { return MergeMode::LargestFirst; }
+        std::vector<MergeRect> merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const override;
+        bool usesIntegral(SampleGrid const&) const override { return false; }
+    };
+
+    // Recursively halves the grid until each leaf is opaque, no longer than maxSpan and has an
+    // RMS error per channel of at most `tolerance` around its mean, which it is painted with. Variance comes
+    // from the integral image, so each split test is O(1) and flat areas stay a few large leaves.
+    // Neighbouring leaves are then fused along rows and columns where the union still passes.
+    class QuadtreeMerge : public MergeStrategy {
+    public:
+        MergeMode getMode() const override { return MergeMode::Quadtree; }
+        std::vector<MergeRect> merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const override;
+    };
+
+    // Row-major scan like GreedyMerge, but a block grows while the RMS error per channel of its
+    // cells around the block's running mean stays within tolerance, and it is painted with that mean.
+    // Both the mean and the error of each candidate come from the integral image in O(1).
+    class ErrorBudgetMerge : public MergeStrategy {
+    public:
+        MergeMode getMode() const override { return MergeMode::ErrorBudget; }
+        std::vector<MergeRect> merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const override;
+    };
+
+    // Parallel counterpart of LargestFirstMerge: regions are flood-filled per 64-row band and joined
+    // across band edges only while every cell stays within tolerance of the joined region's first
+    // cell, so they can split where LargestFirst's single fill wouldn't. Large compact regions are
+    // covered one each in parallel, the rest in row bands no region crosses. Blocks are painted with
+    // their mean colour wherever every cell stays within tolerance of it, and with the region's
+    // first cell otherwise.
+    class ComponentMerge : public MergeStrategy {
+    public:
+        MergeMode getMode() const override { return MergeMode::Components; }
+        std::vector<MergeRect> merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const override;
+    };
+}
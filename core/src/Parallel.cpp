@@ -0,0 +1,99 @@
+#include <itb/Parallel.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace itb {
+    namespace {
+        std::atomic<int> threadOverride{0};
+
+        // Process-wide workers for parallelFor, started on first use and grown on demand; they never
+        // exit. Every thread waiting on a call runs queued slices itself, so a slice that calls
+        // parallelFor again can't starve the pool.
+        class WorkerPool {
+        public:
+            static WorkerPool& get() {
+                // Leaked so exit never has to join workers parked on the condition variable.
+                static WorkerPool* pool = new WorkerPool();
+                return *pool;
+            }
+
+            void run(int slices, std::function<void(int slice)> const& body) {
+                int left = slices - 1;
+                {
+                    std::lock_guard lock(m_mutex);
+                    while (int(m_workerCount) < slices - 1) {
+                        std::thread([this] { this->work(); }).detach();
+                        m_workerCount++;
+                    }
+                    for (int i = 1; i < slices; i++) m_tasks.push_back({ &body, i, &left });
+                }
+                m_wake.notify_all();
+
+                body(0);
+                std::unique_lock lock(m_mutex);
+                while (left > 0) {
+                    if (m_tasks.empty()) m_wake.wait(lock);
+                    else this->runFront(lock);
+                }
+            }
+
+        private:
+            struct Task {
+                std::function<void(int slice)> const* body;
+                int slice;
+                // Slices of the owning call still queued or running; guarded by m_mutex.
+                int* left;
+            };
+
+            std::mutex m_mutex;
+            std::condition_variable m_wake;
+            std::deque<Task> m_tasks;
+            size_t m_workerCount = 0;
+
+            // Pops and runs the oldest task with the lock released, then wakes whoever waits on it.
+            void runFront(std::unique_lock<std::mutex>& lock) {
+                Task task = m_tasks.front();
+                m_tasks.pop_front();
+                lock.unlock();
+                (*task.body)(task.slice);
+                lock.lock();
+                if (--*task.left == 0) m_wake.notify_all();
+            }
+
+            void work() {
+                std::unique_lock lock(m_mutex);
+                while (true) {
+                    m_wake.wait(lock, [this] { return !m_tasks.empty(); });
+                    this->runFront(lock);
+                }
+            }
+        };
+    }
+
+    int getThreadCount() {
+        if (int count = threadOverride.load(std::memory_order_relaxed)) return count;
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    void setThreadCount(int count) {
+        threadOverride.store(std::max(0, count), std::memory_order_relaxed);
+    }
+
+    void parallelFor(int count, std::function<void(int begin, int end)> const& body, int grain) {
+        if (count <= 0) return;
+        grain = std::max(1, grain);
+        int slices = std::min(getThreadCount(), (count + grain - 1) / grain);
+        if (slices <= 1) {
+            body(0, count);
+            return;
+        }
+
+        auto sliceBegin = [&](int i) { return (int)((long long)count * i / slices); };
+        WorkerPool::get().run(slices, [&](int slice) { body(sliceBegin(slice), sliceBegin(slice + 1)); });
+    }
+}
@@ -0,0 +1,137 @@
+#include <itb/Pipeline.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <sstream>
+#include <unordered_map>
+
+namespace itb {
+    GDHSV rgbToGdhsv(Color3 color) {
+        float r = color.r / 255.0f;
+        float g = color.g / 255.0f;
+        float b = color.b / 255.0f;
+        float max = std::max({r, g, b}), min = std::min({r, g, b});
+        float d = max - min, h = 0, s = (max > 0 ? d / max : 0), v = max;
+
+        if (max != min) {
+            if (max == r) h = (g - b) / d + (g < b ? 6 : 0);
+            else if (max == g) h = (b - r) / d + 2;
+            else h = (r - g) / d + 4;
+            h /= 6;
+        }
+        return { h * 360.0f, s, v };
+    }
+
+    int calculateSafeStep(int w, int h) {
+        int maxDim = std::max(w, h);
+        int step = (maxDim > 200) ? static_cast<int>(std::ceil(maxDim / 200.0f)) : 1;
+        long long total = (long long)w * h;
+        while ((total / (step * step)) > kSafeObjectCount) step++;
+        return step;
+    }
+
+    int calculateMaxSpan(float visualScale, float maxObjectScale) {
+        if (visualScale <= 0.0f) return 1;
+        // Tolerate float noise so 2.0 / 0.1 still yields 20.
+        return std::max(1, static_cast<int>(std::floor(maxObjectScale / visualScale + 1e-4f)));
+    }
+
+    MergeParams getMergeParams(ImportSettings const& settings) {
+        int maxSpan = settings.maxSpan > 0 ? settings.maxSpan : calculateMaxSpan(settings.visualScale);
+        return { .tolerance = settings.tolerance, .maxSpan = settings.merge ? maxSpan : 1, .metric = settings.metric };
+    }
+
+    std::vector<BlockData> buildBlocks(SampleGrid const& grid, ImportSettings const& settings) {
+        return buildBlocks(grid, mergeUsesIntegral(grid, settings) ? IntegralImage(grid) : IntegralImage(), settings);
+    }
+
+    bool mergeUsesIntegral(SampleGrid const& grid, ImportSettings const& settings) {
+        return createMergeStrategy(settings.strategy)->usesIntegral(grid);
+    }
+
+    std::vector<MergeRect> mergeGrid(SampleGrid const& grid, IntegralImage const& integral, ImportSettings const& settings,
+        CancelToken cancel) {
+        auto strategy = createMergeStrategy(settings.strategy);
+        auto params = getMergeParams(settings);
+        params.cancel = cancel;
+        if (settings.layers > 0) return mergeLayered(*strategy, grid, integral, params, settings.layers);
+        return strategy->merge(grid, integral, params);
+    }
+
+    std::vector<BlockData> buildBlocks(SampleGrid const& grid, IntegralImage const& integral, ImportSettings const& settings) {
+        auto rects = mergeGrid(grid, integral, settings);
+
+        std::vector<BlockData> blocks;
+        blocks.reserve(rects.size());
+        float visualScale = settings.visualScale;
+        float effSize = 30.0f * visualScale;
+        float sX = -(grid.width * effSize) / 2.0f;
+        float sY = (grid.height * effSize) / 2.0f;
+
+        for (auto const& r : rects) {
+            Color3 color = { (uint8_t)cellRed(r.color), (uint8_t)cellGreen(r.color), (uint8_t)cellBlue(r.color) };
+            blocks.push_back({
+                sX + (r.x * effSize) + (effSize * r.spanX / 2.0f),
+                sY - (r.y * effSize) - (effSize * r.spanY / 2.0f),
+                r.spanX, r.spanY, visualScale, rgbToGdhsv(color), color, r.z
+            });
+        }
+        return blocks;
+    }
+
+    std::optional<std::vector<BlockData>> importImage(ImageHandle& image, ImportSettings const& settings) {
+        auto grid = image.getSampleGrid(settings.step, settings.sampling);
+        if (!grid) return std::nullopt;
+        // The cached tables only describe the unquantized grid, so a quantized import never builds them.
+        if (settings.paletteSize > 0) return buildBlocks(quantizeGrid(*grid, settings.paletteSize, settings.dither), settings);
+        if (!mergeUsesIntegral(*grid, settings)) return buildBlocks(*grid, IntegralImage(), settings);
+        auto integral = image.getIntegralImage(settings.step, settings.sampling);
+        if (!integral) return std::nullopt;
+        return buildBlocks(*grid, *integral, settings);
+    }
+
+    std::optional<size_t> countImportBlocks(ImageHandle& image, ImportSettings const& settings, CancelToken cancel) {
+        auto grid = image.getSampleGrid(settings.step, settings.sampling);
+        if (!grid || cancel.cancelled()) return std::nullopt;
+        std::vector<MergeRect> rects;
+        if (settings.paletteSize > 0) {
+            auto quantized = quantizeGrid(*grid, settings.paletteSize, settings.dither);
+            if (cancel.cancelled()) return std::nullopt;
+            rects = mergeGrid(quantized, mergeUsesIntegral(quantized, settings) ? IntegralImage(quantized) : IntegralImage(), settings, cancel);
+        } else if (!mergeUsesIntegral(*grid, settings)) {
+            rects = mergeGrid(*grid, IntegralImage(), settings, cancel);
+        } else {
+            auto integral = image.getIntegralImage(settings.step, settings.sampling);
+            if (!integral) return std::nullopt;
+            rects = mergeGrid(*grid, *integral, settings, cancel);
+        }
+        if (cancel.cancelled()) return std::nullopt;
+        return rects.size();
+    }
+
+    std::string buildLevelString(std::vector<BlockData> const& blocks, float originX, float originY) {
+        std::ostringstream ss;
+        // Merged and quantized imports reuse few colours, so each HSV field is formatted once.
+        std::unordered_map<uint32_t, std::string> hsvFields;
+        for (auto const& b : blocks) {
+            auto [it, added] = hsvFields.try_emplace(packRGBA(b.color.r, b.color.g, b.color.b, 0));
+            if (added) {
+                // Shortest round-trip digits, as fmt's "{}" printed them; a stream would round to 6.
+                auto& field = it->second;
+                for (float value : { b.hsv.h, b.hsv.s, b.hsv.v }) {
+                    char digits[32];
+                    field.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+                    field += 'a';
+                }
+                field += "1a1";
+            }
+            ss << "1,211,2," << originX + b.x << ",3," << originY + b.y
+               << ",41,1,67,1,43," << it->second
+               << ",128," << b.visualScale * b.spanX << ",129," << b.visualScale * b.spanY;
+            if (b.zOrder) ss << ",25," << b.zOrder;
+            ss << ';';
+        }
+        return ss.str();
+    }
+}
@@ -0,0 +1,522 @@
+#include "PngStream.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace itb {
+    namespace {
+        // stb_image's default STBI_MAX_DIMENSIONS.
+        constexpr int kMaxDimension = 1 << 24;
+
+        uint32_t readBE32(unsigned char const* p) {
+            return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        }
+
+        // Yields the payload of consecutive IDAT chunks as one byte stream, in place.
+        class IdatStream {
+        public:
+            IdatStream(std::span<const unsigned char> data, size_t offset) : m_data(data), m_pos(offset) {
+                m_ok = this->enterChunk();
+            }
+
+            int next() {
+                while (m_left == 0) {
+                    if (!m_ok) return -1;
+                    m_pos += 4;
+                    m_ok = this->enterChunk();
+                }
+                m_left--;
+                return m_data[m_pos++];
+            }
+
+        private:
+            std::span<const unsigned char> m_data;
+            size_t m_pos;
+            size_t m_left = 0;
+            bool m_ok = false;
+
+            bool enterChunk() {
+                if (m_pos + 8 > m_data.size()) return false;
+                uint32_t length = readBE32(&m_data[m_pos]);
+                if (std::memcmp(&m_data[m_pos + 4], "IDAT", 4) != 0) return false;
+                if (length > m_data.size() - m_pos - 8) return false;
+                m_pos += 8;
+                m_left = length;
+                return true;
+            }
+        };
+
+        class BitReader {
+        public:
+            explicit BitReader(IdatStream& in) : m_in(in) {}
+
+            unsigned take(int n) {
+                if (m_count < n) this->refill();
+                unsigned value = unsigned(m_bits & ((uint64_t(1) << n) - 1));
+                m_bits >>= n;
+                m_count -= n;
+                return value;
+            }
+
+            unsigned peek16() {
+                if (m_count < 16) this->refill();
+                return unsigned(m_bits & 0xffff);
+            }
+
+            void drop(int n) {
+                m_bits >>= n;
+                m_count -= n;
+            }
+
+            void alignToByte() { this->drop(m_count & 7); }
+
+            // True once bits past the end of the IDAT data have actually been consumed.
+            bool exhausted() const { return m_overrun * 8 > m_count; }
+
+        private:
+            IdatStream& m_in;
+            uint64_t m_bits = 0;
+            int m_count = 0;
+            int m_overrun = 0;
+
+            void refill() {
+                while (m_count <= 56) {
+                    int byte = m_in.next();
+                    if (byte < 0) {
+                        byte = 0;
+                        m_overrun++;
+                    }
+                    m_bits |= uint64_t(byte) << m_count;
+                    m_count += 8;
+                }
+            }
+        };
+
+        unsigned reverseBits(unsigned code, int length) {
+            unsigned result = 0;
+            for (int i = 0; i < length; i++) {
+                result = (result << 1) | (code & 1);
+                code >>= 1;
+            }
+            return result;
+        }
+
+        // Canonical Huffman decoder with a 9-bit direct lookup and a per-length fallback.
+        class Huffman {
+        public:
+            static constexpr int FastBits = 9;
+
+            bool build(unsigned char const* lengths, int count) {
+                int sizes[17] = {};
+                int nextCode[16] = {};
+                std::memset(m_fast, 0, sizeof(m_fast));
+                for (int i = 0; i < count; i++) sizes[lengths[i]]++;
+                sizes[0] = 0;
+
+                int code = 0, symbol = 0;
+                for (int i = 1; i < 16; i++) {
+                    nextCode[i] = code;
+                    m_firstCode[i] = uint16_t(code);
+                    m_firstSymbol[i] = uint16_t(symbol);
+                    code += sizes[i];
+                    if (sizes[i] && code - 1 >= (1 << i)) return false;
+                    m_maxCode[i] = code << (16 - i);
+                    code <<= 1;
+                    symbol += sizes[i];
+                }
+                m_maxCode[16] = 0x10000;
+
+                for (int i = 0; i < count; i++) {
+                    int length = lengths[i];
+                    if (!length) continue;
+                    int slot = nextCode[length] - m_firstCode[length] + m_firstSymbol[length];
+                    m_size[slot] = uint8_t(length);
+                    m_value[slot] = uint16_t(i);
+                    if (length <= FastBits) {
+                        unsigned j = reverseBits(nextCode[length], length);
+                        while (j < (1u << FastBits)) {
+                            m_fast[j] = uint16_t((length << FastBits) | i);
+                            j += 1u << length;
+                        }
+                    }
+                    nextCode[length]++;
+                }
+                return true;
+            }
+
+            int decode(BitReader& bits) const {
+                unsigned window = bits.peek16();
+                if (unsigned entry = m_fast[window & ((1u << FastBits) - 1)]) {
+                    bits.drop(int(entry >> FastBits));
+                    return int(entry & ((1u << FastBits) - 1));
+                }
+
+                unsigned k = reverseBits(window, 16);
+                int length = FastBits + 1;
+                while (length < 16 && int(k) >= m_maxCode[length]) length++;
+                if (length >= 16) return -1;
+                int slot = int(k >> (16 - length)) - m_firstCode[length] + m_firstSymbol[length];
+                if (slot >= 288 || m_size[slot] != length) return -1;
+                bits.drop(length);
+                return m_value[slot];
+            }
+
+        private:
+            uint16_t m_fast[1 << FastBits];
+            uint16_t m_firstCode[16];
+            uint16_t m_firstSymbol[16];
+            int m_maxCode[17];
+            uint8_t m_size[288];
+            uint16_t m_value[288];
+        };
+
+        constexpr int LengthBase[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+        };
+        constexpr int LengthExtra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+        };
+        constexpr int DistBase[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+        };
+        constexpr int DistExtra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+        };
+
+        bool readDynamicTables(BitReader& bits, Huffman& literals, Huffman& distances) {
+            static constexpr int order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+            int literalCount = int(bits.take(5)) + 257;
+            int distanceCount = int(bits.take(5)) + 1;
+            int codeLengthCount = int(bits.take(4)) + 4;
+            // HLIT and HDIST can encode up to 288 and 32, but RFC 1951 only allows 286 and 30.
+            if (literalCount > 286 || distanceCount > 30) return false;
+
+            unsigned char codeLengths[19] = {};
+            for (int i = 0; i < codeLengthCount; i++) codeLengths[order[i]] = uint8_t(bits.take(3));
+
+            Huffman codeLengthCode;
+            if (!codeLengthCode.build(codeLengths, 19)) return false;
+
+            unsigned char lengths[286 + 30] = {};
+            int total = literalCount + distanceCount;
+            int n = 0;
+            while (n < total) {
+                int symbol = codeLengthCode.decode(bits);
+                if (symbol < 0) return false;
+                if (symbol < 16) {
+                    lengths[n++] = uint8_t(symbol);
+                    continue;
+                }
+
+                int repeat;
+                unsigned char fill = 0;
+                if (symbol == 16) {
+                    if (n == 0) return false;
+                    repeat = 3 + int(bits.take(2));
+                    fill = lengths[n - 1];
+                }
+                else if (symbol == 17) repeat = 3 + int(bits.take(3));
+                else repeat = 11 + int(bits.take(7));
+
+                if (n + repeat > total) return false;
+                std::memset(lengths + n, fill, repeat);
+                n += repeat;
+            }
+
+            return literals.build(lengths, literalCount) && distances.build(lengths + literalCount, distanceCount);
+        }
+
+        void buildFixedTables(Huffman& literals, Huffman& distances) {
+            unsigned char lengths[288];
+            std::fill(lengths, lengths + 144, 8);
+            std::fill(lengths + 144, lengths + 256, 9);
+            std::fill(lengths + 256, lengths + 280, 7);
+            std::fill(lengths + 280, lengths + 288, 8);
+            literals.build(lengths, 288);
+
+            std::fill(lengths, lengths + 32, 5);
+            distances.build(lengths, 32);
+        }
+
+        // Streaming zlib inflate. Output goes byte by byte to `sink.put` through a 32 KiB history
+        // window; decoding stops as soon as `sink.isDone()` reports it has every row it needs.
+        template <class Sink>
+        bool inflate(IdatStream& in, Sink& sink) {
+            BitReader bits(in);
+            unsigned cmf = bits.take(8), flg = bits.take(8);
+            if ((cmf & 15) != 8 || (cmf * 256 + flg) % 31 != 0 || (flg & 32)) return false;
+
+            static constexpr size_t WindowMask = 32767;
+            std::vector<unsigned char> window(WindowMask + 1);
+            size_t total = 0;
+            auto emit = [&](unsigned char byte) {
+                window[total & WindowMask] = byte;
+                total++;
+                sink.put(byte);
+            };
+
+            Huffman literals, distances;
+            bool final = false;
+            while (!final) {
+                final = bits.take(1);
+                unsigned type = bits.take(2);
+
+                if (type == 0) {
+                    bits.alignToByte();
+                    unsigned length = bits.take(16), inverse = bits.take(16);
+                    if (length != (~inverse & 0xffff)) return false;
+                    for (unsigned i = 0; i < length && !sink.isDone(); i++) emit(uint8_t(bits.take(8)));
+                }
+                else if (type == 3) return false;
+                else {
+                    if (type == 1) buildFixedTables(literals, distances);
+                    else if (!readDynamicTables(bits, literals, distances)) return false;
+
+                    for (;;) {
+                        if (sink.isDone()) return true;
+                        if (bits.exhausted()) return false;
+
+                        int symbol = literals.decode(bits);
+                        if (symbol < 0) return false;
+                        if (symbol < 256) {
+                            emit(uint8_t(symbol));
+                            continue;
+                        }
+                        if (symbol == 256) break;
+
+                        symbol -= 257;
+                        if (symbol >= 29) return false;
+                        int length = LengthBase[symbol] + int(bits.take(LengthExtra[symbol]));
+
+                        int code = distances.decode(bits);
+                        if (code < 0 || code >= 30) return false;
+                        size_t distance = size_t(DistBase[code]) + bits.take(DistExtra[code]);
+                        if (distance > total) return false;
+
+                        for (int i = 0; i < length; i++) emit(window[(total - distance) & WindowMask]);
+                    }
+                }
+                if (sink.isDone()) return true;
+                if (bits.exhausted()) return false;
+            }
+            return true;
+        }
+
+        int paeth(int a, int b, int c) {
+            int p = a + b - c;
+            int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+            if (pa <= pb && pa <= pc) return a;
+            return pb <= pc ? b : c;
+        }
+
+        bool unfilterRow(int filter, unsigned char* row, unsigned char const* prior, size_t size, size_t bpp) {
+            switch (filter) {
+                case 0: break;
+                case 1:
+                    for (size_t i = bpp; i < size; i++) row[i] += row[i - bpp];
+                    break;
+                case 2:
+                    for (size_t i = 0; i < size; i++) row[i] += prior[i];
+                    break;
+                case 3:
+                    for (size_t i = 0; i < bpp; i++) row[i] += prior[i] >> 1;
+                    for (size_t i = bpp; i < size; i++) row[i] += (row[i - bpp] + prior[i]) >> 1;
+                    break;
+                case 4:
+                    for (size_t i = 0; i < bpp; i++) row[i] += prior[i];
+                    for (size_t i = bpp; i < size; i++) row[i] += uint8_t(paeth(row[i - bpp], prior[i], prior[i - bpp]));
+                    break;
+                default: return false;
+            }
+            return true;
+        }
+
+        template <class OnRow>
+        struct RowSink {
+            std::vector<unsigned char>& row;
+            OnRow& onRow;
+            size_t fill = 0;
+            bool done = false;
+
+            void put(unsigned char byte) {
+                row[fill++] = byte;
+                if (fill == row.size()) {
+                    fill = 0;
+                    done = onRow();
+                }
+            }
+
+            bool isDone() const { return done; }
+        };
+
+        // Matches stb's scaling of sub-byte grey samples to 0..255.
+        constexpr unsigned char DepthScale[9] = { 0, 0xff, 0x55, 0, 0x11, 0, 0, 0, 0x01 };
+    }
+
+    bool PngRowReader::open(std::span<const unsigned char> data) {
+        static unsigned char const signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        if (data.size() < 8 || std::memcmp(data.data(), signature, 8) != 0) return false;
+
+        m_data = data;
+        for (int i = 0; i < 256; i++) m_palette[i * 4 + 3] = 255;
+
+        bool seenHeader = false;
+        int paletteSize = 0;
+        size_t pos = 8;
+        while (pos + 8 <= data.size()) {
+            uint32_t length = readBE32(&data[pos]);
+            unsigned char const* type = &data[pos + 4];
+            unsigned char const* body = &data[pos + 8];
+            if (length > data.size() - pos - 8) return false;
+
+            if (!std::memcmp(type, "IHDR", 4)) {
+                if (seenHeader || length != 13) return false;
+                seenHeader = true;
+                m_width = int(readBE32(body));
+                m_height = int(readBE32(body + 4));
+                m_depth = body[8];
+                m_colorType = body[9];
+                if (body[10] != 0 || body[11] != 0 || body[12] != 0) return false;
+                if (m_width <= 0 || m_height <= 0) return false;
+                // Same limits as stb_image, which takes over when this returns false: no side over
+                // STBI_MAX_DIMENSIONS and no RGBA buffer past INT_MAX bytes. Headers claiming more
+                // would otherwise size the row buffers and grid to whatever they ask for.
+                if (m_width > kMaxDimension || m_height > kMaxDimension) return false;
+                if ((long long)m_width * m_height > INT_MAX / 4) return false;
+
+                switch (m_colorType) {
+                    case 0: m_channels = 1; break;
+                    case 2: m_channels = 3; break;
+                    case 3: m_channels = 1; break;
+                    case 4: m_channels = 2; break;
+                    case 6: m_channels = 4; break;
+                    default: return false;
+                }
+                bool validDepth = m_depth == 1 || m_depth == 2 || m_depth == 4 || m_depth == 8 || m_depth == 16;
+                if (!validDepth) return false;
+                if (m_colorType == 3 && m_depth == 16) return false;
+                if ((m_colorType == 2 || m_colorType == 4 || m_colorType == 6) && m_depth < 8) return false;
+            }
+            else if (!std::memcmp(type, "CgBI", 4)) return false;
+            else if (!seenHeader) return false;
+            else if (!std::memcmp(type, "PLTE", 4)) {
+                if (length > 256 * 3 || length % 3) return false;
+                paletteSize = int(length / 3);
+                for (int i = 0; i < paletteSize; i++) {
+                    m_palette[i * 4 + 0] = body[i * 3 + 0];
+                    m_palette[i * 4 + 1] = body[i * 3 + 1];
+                    m_palette[i * 4 + 2] = body[i * 3 + 2];
+                }
+            }
+            else if (!std::memcmp(type, "tRNS", 4)) {
+                if (m_colorType == 3) {
+                    if (length > uint32_t(paletteSize)) return false;
+                    for (uint32_t i = 0; i < length; i++) m_palette[i * 4 + 3] = body[i];
+                }
+                else {
+                    if (m_colorType != 0 && m_colorType != 2) return false;
+                    if (length != uint32_t(m_channels * 2)) return false;
+                    m_hasTransparency = true;
+                    for (int k = 0; k < m_channels; k++) {
+                        unsigned value = (unsigned(body[k * 2]) << 8) | body[k * 2 + 1];
+                        m_transparent[k] = m_depth == 16 ? value : (value & 255) * DepthScale[m_depth];
+                    }
+                }
+            }
+            else if (!std::memcmp(type, "IDAT", 4)) {
+                if (m_colorType == 3 && !paletteSize) return false;
+                m_idatOffset = pos;
+                return true;
+            }
+            else if (!std::memcmp(type, "IEND", 4)) return false;
+
+            pos += 12 + size_t(length);
+        }
+        return false;
+    }
+
+    void PngRowReader::convertRow(unsigned char const* row, unsigned char* rgba) const {
+        auto sample = [&](size_t index) -> unsigned {
+            if (m_depth == 8) return row[index];
+            if (m_depth == 16) return (unsigned(row[index * 2]) << 8) | row[index * 2 + 1];
+            size_t bit = index * m_depth;
+            return (row[bit >> 3] >> (8 - m_depth - (bit & 7))) & ((1u << m_depth) - 1);
+        };
+        auto to8 = [&](unsigned value) -> unsigned char {
+            if (m_depth == 16) return uint8_t(value >> 8);
+            return uint8_t(value * DepthScale[m_depth]);
+        };
+        auto isTransparent = [&](unsigned value, unsigned char scaled, int k) {
+            return m_depth == 16 ? value == m_transparent[k] : scaled == m_transparent[k];
+        };
+
+        for (int x = 0; x < m_width; x++) {
+            unsigned char* out = rgba + size_t(x) * 4;
+            size_t base = size_t(x) * m_channels;
+            switch (m_colorType) {
+                case 0: {
+                    unsigned v = sample(base);
+                    unsigned char g = to8(v);
+                    out[0] = out[1] = out[2] = g;
+                    out[3] = (m_hasTransparency && isTransparent(v, g, 0)) ? 0 : 255;
+                    break;
+                }
+                case 2: {
+                    bool transparent = m_hasTransparency;
+                    for (int k = 0; k < 3; k++) {
+                        unsigned v = sample(base + k);
+                        out[k] = to8(v);
+                        transparent = transparent && isTransparent(v, out[k], k);
+                    }
+                    out[3] = transparent ? 0 : 255;
+                    break;
+                }
+                case 3:
+                    std::memcpy(out, &m_palette[sample(base) * 4], 4);
+                    break;
+                case 4:
+                    out[0] = out[1] = out[2] = to8(sample(base));
+                    out[3] = to8(sample(base + 1));
+                    break;
+                case 6:
+                    for (int k = 0; k < 4; k++) out[k] = to8(sample(base + k));
+                    break;
+            }
+        }
+    }
+
+    bool PngRowReader::readRows(int rowStep, RowCallback const& onRow) {
+        rowStep = std::max(1, rowStep);
+        size_t bitsPerPixel = size_t(m_depth) * m_channels;
+        size_t stride = (size_t(m_width) * bitsPerPixel + 7) / 8;
+        size_t bpp = std::max<size_t>(1, bitsPerPixel / 8);
+
+        std::vector<unsigned char> row(stride + 1), prior(stride + 1, 0), rgba(size_t(m_width) * 4);
+        int y = 0;
+        bool failed = false;
+
+        auto finishRow = [&]() {
+            if (!unfilterRow(row[0], row.data() + 1, prior.data() + 1, stride, bpp)) {
+                failed = true;
+                return true;
+            }
+            if (y % rowStep == 0) {
+                this->convertRow(row.data() + 1, rgba.data());
+                onRow(y, rgba.data());
+            }
+            std::swap(row, prior);
+            return ++y >= m_height;
+        };
+
+        RowSink<decltype(finishRow)> sink{ row, finishRow };
+        IdatStream in(m_data, m_idatOffset);
+        if (!inflate(in, sink)) return false;
+        return !failed && y == m_height;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <functional>
+#include <span>
+#include <vector>
+
+namespace itb {
+    // Row-at-a-time PNG decoder. Inflates and unfilters scanlines in a rolling two-row buffer, so only
+    // the rows a caller asks for are ever expanded to RGBA. Interlaced and Apple CgBI files are not
+    // handled; open() rejects them and callers fall back to stb.
+    class PngRowReader {
+    public:
+        using RowCallback = std::function<void(int y, unsigned char const* rgba)>;
+
+        bool open(std::span<const unsigned char> data);
+
+        int getWidth() const { return m_width; }
+        int getHeight() const { return m_height; }
+
+        // Decodes the whole image, calling `onRow` with an RGBA row for every y where y % rowStep == 0.
+        bool readRows(int rowStep, RowCallback const& onRow);
+
+    private:
+        std::span<const unsigned char> m_data;
+        size_t m_idatOffset = 0;
+
+        int m_width = 0;
+        int m_height = 0;
+        int m_depth = 0;
+        int m_colorType = 0;
+        int m_channels = 0;
+
+        unsigned char m_palette[256 * 4] = {};
+        bool m_hasTransparency = false;
+        unsigned m_transparent[3] = {};
+
+        void convertRow(unsigned char const* row, unsigned char* rgba) const;
+    };
+}
@@ -0,0 +1,78 @@
+#include <itb/Preview.hpp>
+
+#include <itb/Quantize.hpp>
+
+#include <algorithm>
+
+namespace itb {
+    std::optional<PreviewMerge> mergePreview(ImageHandle& image, ImportSettings const& settings, int maxSize,
+        CancelToken cancel) {
+        auto grid = image.getSampleGrid(settings.step, settings.sampling);
+        if (!grid || cancel.cancelled()) return std::nullopt;
+
+        PreviewMerge preview;
+        int longest = std::max(grid->width, grid->height);
+        preview.factor = std::max(1, (longest + maxSize - 1) / std::max(1, maxSize));
+
+        ImportSettings scaled = settings;
+        SampleGrid cells;
+        if (preview.factor == 1) cells = *grid;
+        else {
+            auto source = gridToImage(*grid);
+            cells = settings.sampling == SampleMode::Average ? averageGrid(source, preview.factor) : sampleGrid(source, preview.factor);
+            scaled.maxSpan = std::max(1, getMergeParams(settings).maxSpan / preview.factor);
+        }
+        if (settings.paletteSize > 0) cells = quantizeGrid(cells, settings.paletteSize, settings.dither);
+        if (cancel.cancelled()) return std::nullopt;
+
+        preview.width = cells.width;
+        preview.height = cells.height;
+        // The import grid's tables are only valid for the import grid itself, so they are only
+        // fetched (and built on first use) when that is what gets merged, and only for strategies
+        // that read them.
+        if (!mergeUsesIntegral(cells, scaled)) {
+            preview.rects = mergeGrid(cells, IntegralImage(), scaled, cancel);
+        } else if (preview.factor == 1 && settings.paletteSize == 0) {
+            auto integral = image.getIntegralImage(settings.step, settings.sampling);
+            if (!integral) return std::nullopt;
+            preview.rects = mergeGrid(cells, *integral, scaled, cancel);
+        } else {
+            preview.rects = mergeGrid(cells, IntegralImage(cells), scaled, cancel);
+        }
+        if (cancel.cancelled()) return std::nullopt;
+        return preview;
+    }
+
+    Image renderPreview(PreviewMerge const& merge, int maxSize, bool outlines) {
+        int scale = std::max(1, maxSize / std::max({ 1, merge.width, merge.height }));
+        Image image { merge.width * scale, merge.height * scale, {} };
+        image.pixels.assign(size_t(image.width) * image.height * 4, 0);
+
+        auto paint = [&](int x0, int y0, int x1, int y1, uint32_t color) {
+            for (int y = y0; y < y1; y++) {
+                unsigned char* px = &image.pixels[(size_t(y) * image.width + x0) * 4];
+                for (int x = x0; x < x1; x++, px += 4) {
+                    px[0] = (unsigned char)cellRed(color);
+                    px[1] = (unsigned char)cellGreen(color);
+                    px[2] = (unsigned char)cellBlue(color);
+                    px[3] = 255;
+                }
+            }
+        };
+
+        for (auto const& r : merge.rects) {
+            int x0 = r.x * scale, y0 = r.y * scale;
+            int x1 = x0 + r.spanX * scale, y1 = y0 + r.spanY * scale;
+            paint(x0, y0, x1, y1, r.color);
+            if (!outlines) continue;
+
+            // Edges at 60% brightness.
+            uint32_t edge = packRGBA(cellRed(r.color) * 3 / 5, cellGreen(r.color) * 3 / 5, cellBlue(r.color) * 3 / 5, 255);
+            paint(x0, y0, x1, y0 + 1, edge);
+            paint(x0, y1 - 1, x1, y1, edge);
+            paint(x0, y0, x0 + 1, y1, edge);
+            paint(x1 - 1, y0, x1, y1, edge);
+        }
+        return image;
+    }
+}
@@ -0,0 +1,93 @@
+#include "MergeStrategies.hpp"
+
+#include <algorithm>
+
+namespace itb {
+    namespace {
+        struct Node {
+            int x, y, w, h;
+        };
+
+        // Fuses runs of leaves that share an edge along one axis whenever the union still passes the
+        // leaf test, undoing splits the fixed midpoints forced on regions straddling them.
+        void coalesce(std::vector<MergeRect>& rects, IntegralImage const& integral, MergeParams const& params, double maxVariance, bool horizontal) {
+            int maxSpan = std::max(1, params.maxSpan);
+            auto along = [horizontal](MergeRect const& r) { return horizontal ? r.x : r.y; };
+            auto across = [horizontal](MergeRect const& r) { return horizontal ? r.y : r.x; };
+            auto length = [horizontal](MergeRect& r) -> int& { return horizontal ? r.spanX : r.spanY; };
+            auto thickness = [horizontal](MergeRect const& r) { return horizontal ? r.spanY : r.spanX; };
+
+            std::sort(rects.begin(), rects.end(), [&](MergeRect const& a, MergeRect const& b) {
+                if (across(a) != across(b)) return across(a) < across(b);
+                if (thickness(a) != thickness(b)) return thickness(a) < thickness(b);
+                return along(a) < along(b);
+            });
+            if (params.cancel.cancelled()) return;
+
+            size_t out = 0;
+            for (size_t i = 0; i < rects.size(); i++) {
+                if (out > 0) {
+                    MergeRect& last = rects[out - 1];
+                    MergeRect const& next = rects[i];
+                    if (across(last) == across(next) && thickness(last) == thickness(next) &&
+                        along(last) + length(last) == along(next) && length(last) + length(rects[i]) <= maxSpan) {
+                        MergeRect joined = last;
+                        length(joined) += length(rects[i]);
+                        auto stats = integral.query(joined.x, joined.y, joined.spanX, joined.spanY);
+                        if (stats.isOpaque() && stats.variance() <= maxVariance) {
+                            joined.color = stats.meanColor();
+                            last = joined;
+                            continue;
+                        }
+                    }
+                }
+                rects[out++] = rects[i];
+            }
+            rects.resize(out);
+        }
+    }
+
+    std::vector<MergeRect> QuadtreeMerge::merge(SampleGrid const& grid, IntegralImage const& integral, MergeParams const& params) const {
+        int maxSpan = std::max(1, params.maxSpan);
+        double maxVariance = maxBlockVariance(params.tolerance);
+
+        std::vector<MergeRect> rects;
+        std::vector<Node> stack;
+        if (grid.width > 0 && grid.height > 0) stack.push_back({ 0, 0, grid.width, grid.height });
+
+        while (!stack.empty() && !params.cancel.cancelled()) {
+            Node node = stack.back();
+            stack.pop_back();
+
+            auto stats = integral.query(node.x, node.y, node.w, node.h);
+            if (!stats.opaque) continue;
+
+            bool fits = node.w <= maxSpan && node.h <= maxSpan;
+            bool single = node.w == 1 && node.h == 1;
+            if (single || (fits && stats.isOpaque() && stats.variance() <= maxVariance)) {
+                rects.push_back({ node.x, node.y, node.w, node.h, stats.meanColor() });
+                continue;
+            }
+
+            // Halve both axes where possible.
+            int leftW = node.w > 1 ? (node.w + 1) / 2 : node.w;
+            int topH = node.h > 1 ? (node.h + 1) / 2 : node.h;
+            int rightW = node.w - leftW, bottomH = node.h - topH;
+            if (rightW && bottomH) stack.push_back({ node.x + leftW, node.y + topH, rightW, bottomH });
+            if (bottomH) stack.push_back({ node.x, node.y + topH, leftW, bottomH });
+            if (rightW) stack.push_back({ node.x + leftW, node.y, rightW, topH });
+            stack.push_back({ node.x, node.y, leftW, topH });
+        }
+
+        // Each pass sorts every leaf, so cancellation is polled between them too.
+        for (bool horizontal : { true, false }) {
+            if (params.cancel.cancelled()) return rects;
+            coalesce(rects, integral, params, maxVariance, horizontal);
+        }
+        if (params.cancel.cancelled()) return rects;
+        std::sort(rects.begin(), rects.end(), [](MergeRect const& a, MergeRect const& b) {
+            return a.y != b.y ? a.y < b.y : a.x < b.x;
+        });
+        return rects;
+    }
+}
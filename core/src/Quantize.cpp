@@ -0,0 +1,195 @@
+#include <itb/Quantize.hpp>
+#include <itb/Parallel.hpp>
+
+#include "Dither.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+namespace itb {
+    namespace {
+        constexpr int kBins = 32;
+
+        struct Bin {
+            uint32_t count = 0;
+            uint64_t sum[3] = {};
+        };
+
+        struct Box {
+            int lo[3], hi[3];
+            uint64_t count = 0;
+
+            uint64_t volume() const {
+                return uint64_t(hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1);
+            }
+        };
+
+        int binIndex(int r, int g, int b) {
+            return r << 10 | g << 5 | b;
+        }
+
+        template <class F>
+        void forEachBin(Box const& box, F&& f) {
+            for (int r = box.lo[0]; r <= box.hi[0]; r++)
+                for (int g = box.lo[1]; g <= box.hi[1]; g++)
+                    for (int b = box.lo[2]; b <= box.hi[2]; b++) f(r, g, b);
+        }
+
+        // Tightens a box around its non-empty bins and recounts it.
+        void shrink(Box& box, std::vector<Bin> const& hist) {
+            int lo[3] = { kBins, kBins, kBins }, hi[3] = { -1, -1, -1 };
+            uint64_t count = 0;
+            forEachBin(box, [&](int r, int g, int b) {
+                uint32_t n = hist[binIndex(r, g, b)].count;
+                if (!n) return;
+                int at[3] = { r, g, b };
+                for (int c = 0; c < 3; c++) {
+                    lo[c] = std::min(lo[c], at[c]);
+                    hi[c] = std::max(hi[c], at[c]);
+                }
+                count += n;
+            });
+            for (int c = 0; c < 3; c++) {
+                box.lo[c] = lo[c];
+                box.hi[c] = hi[c];
+            }
+            box.count = count;
+        }
+
+        // Splits `box` at the population median of its longest axis; returns false if it is one bin.
+        bool split(Box& box, Box& other, std::vector<Bin> const& hist) {
+            int axis = 0;
+            for (int c = 1; c < 3; c++) {
+                if (box.hi[c] - box.lo[c] > box.hi[axis] - box.lo[axis]) axis = c;
+            }
+            if (box.hi[axis] == box.lo[axis]) return false;
+
+            std::array<uint64_t, kBins> slab{};
+            forEachBin(box, [&](int r, int g, int b) {
+                int at[3] = { r, g, b };
+                slab[at[axis]] += hist[binIndex(r, g, b)].count;
+            });
+
+            uint64_t half = box.count / 2, seen = 0;
+            int cut = box.lo[axis];
+            for (; cut < box.hi[axis] - 1; cut++) {
+                seen += slab[cut];
+                if (seen >= half) break;
+            }
+
+            other = box;
+            box.hi[axis] = cut;
+            other.lo[axis] = cut + 1;
+            shrink(box, hist);
+            shrink(other, hist);
+            return true;
+        }
+    }
+
+    SampleGrid quantizeGrid(SampleGrid const& grid, int colors, DitherMode dither) {
+        colors = std::clamp(colors, 1, kMaxPaletteSize);
+        int cellCount = grid.width * grid.height;
+
+        std::vector<Bin> hist(kBins * kBins * kBins);
+        std::mutex histMutex;
+        parallelFor(cellCount, [&](int begin, int end) {
+            std::vector<Bin> local(hist.size());
+            for (int i = begin; i < end; i++) {
+                uint32_t cell = grid.cells[i];
+                if (cellAlpha(cell) < 200) continue;
+                Bin& bin = local[binIndex(cell)];
+                bin.count++;
+                bin.sum[0] += cellRed(cell);
+                bin.sum[1] += cellGreen(cell);
+                bin.sum[2] += cellBlue(cell);
+            }
+            std::lock_guard lock(histMutex);
+            for (size_t i = 0; i < hist.size(); i++) {
+                hist[i].count += local[i].count;
+                for (int c = 0; c < 3; c++) hist[i].sum[c] += local[i].sum[c];
+            }
+        }, 1 << 14);
+
+        std::vector<Box> boxes(1, Box{ { 0, 0, 0 }, { kBins - 1, kBins - 1, kBins - 1 } });
+        shrink(boxes[0], hist);
+        if (!boxes[0].count) return grid;
+
+        // Split the most populous boxes for the first half of the palette, then weigh by volume too
+        // so large sparse boxes spanning distinct colours get their share.
+        std::vector<bool> done(1, false);
+        while (int(boxes.size()) < colors) {
+            bool byVolume = boxes.size() * 2 >= size_t(colors);
+            int best = -1;
+            uint64_t bestScore = 0;
+            for (size_t i = 0; i < boxes.size(); i++) {
+                if (done[i]) continue;
+                uint64_t score = byVolume ? boxes[i].count * boxes[i].volume() : boxes[i].count;
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = int(i);
+                }
+            }
+            if (best < 0) break;
+
+            Box other;
+            if (!split(boxes[best], other, hist)) {
+                done[best] = true;
+                continue;
+            }
+            boxes.push_back(other);
+            done.push_back(false);
+        }
+
+        std::vector<uint32_t> palette;
+        std::vector<uint32_t> binColor(hist.size());
+        for (auto const& box : boxes) {
+            uint64_t sum[3] = {};
+            forEachBin(box, [&](int r, int g, int b) {
+                for (int c = 0; c < 3; c++) sum[c] += hist[binIndex(r, g, b)].sum[c];
+            });
+            uint32_t color = packRGBA(
+                uint8_t((sum[0] + box.count / 2) / box.count),
+                uint8_t((sum[1] + box.count / 2) / box.count),
+                uint8_t((sum[2] + box.count / 2) / box.count), 0);
+            palette.push_back(color);
+            forEachBin(box, [&](int r, int g, int b) { binColor[binIndex(r, g, b)] = color; });
+        }
+
+        SampleGrid out;
+        out.width = grid.width;
+        out.height = grid.height;
+        out.cells.resize(grid.cells.size());
+
+        // Dithered colours can land in bins no box covers, so those modes look up the nearest entry.
+        if (dither != DitherMode::None) {
+            auto nearest = nearestBinColors(palette);
+            int amplitude = int(255.0 / std::cbrt(double(palette.size())));
+            switch (dither) {
+                case DitherMode::Bayer: ditherOrdered(grid, out, nearest.data(), bayerMatrix(), amplitude); break;
+                case DitherMode::BlueNoise: ditherOrdered(grid, out, nearest.data(), blueNoiseMatrix(), amplitude); break;
+                default: ditherFloydSteinberg(grid, out, nearest.data()); break;
+            }
+            return out;
+        }
+
+        parallelFor(cellCount, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                uint32_t cell = grid.cells[i];
+                out.cells[i] = cellAlpha(cell) < 200 ? cell : binColor[binIndex(cell)] | (cell & 0xFF000000u);
+            }
+        }, 1 << 14);
+        return out;
+    }
+
+    char const* ditherModeName(DitherMode mode) {
+        switch (mode) {
+            case DitherMode::Bayer: return "Bayer";
+            case DitherMode::BlueNoise: return "Blue Noise";
+            case DitherMode::FloydSteinberg: return "Floyd-Steinberg";
+            default: return "None";
+        }
+    }
+}
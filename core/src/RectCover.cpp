@@ -0,0 +1,95 @@
+#include "RectCover.hpp"
+#include "CoverageMap.hpp"
+
+#include <algorithm>
+
+namespace itb {
+    namespace {
+        struct Candidate {
+            int area;
+            int x, y;
+            int spanX, spanY;
+        };
+    }
+
+    void coverLabels(std::vector<int> const& labels, int gridWidth, int x0, int y0, int w, int h, int only,
+        int maxSpan, CancelToken const& cancel, std::vector<MergeRect>& out) {
+        maxSpan = std::max(1, maxSpan);
+        // Window-local label lookup; cells outside the cover count as taken from the start.
+        auto label = [&](int x, int y) { return labels[size_t(y0 + y) * gridWidth + x0 + x]; };
+        auto wanted = [&](int key) { return only < 0 ? key >= 0 : key == only; };
+
+        CoverageMap covered(w, h);
+        long long remaining = 0;
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                if (!wanted(label(x, y))) covered.set(x, y);
+                else remaining++;
+            }
+        }
+
+        std::vector<Candidate> candidates;
+        std::vector<int> heights(w);
+        std::vector<int> stack;
+
+        while (remaining > 0) {
+            candidates.clear();
+            std::fill(heights.begin(), heights.end(), 0);
+
+            for (int y = 0; y < h; y++) {
+                if (cancel.cancelled()) return;
+                for (int x = 0; x < w; x++) {
+                    if (covered.test(x, y)) heights[x] = 0;
+                    else if (y > 0 && heights[x] > 0 && label(x, y) == label(x, y - 1)) heights[x] = std::min(heights[x] + 1, maxSpan);
+                    else heights[x] = 1;
+                }
+
+                // Each run of same-label cells in this row is an independent histogram; its best bar
+                // becomes one or more maxSpan-wide candidates tiled across the bar's extent.
+                for (int start = 0; start < w;) {
+                    if (!heights[start]) {
+                        start++;
+                        continue;
+                    }
+                    int key = label(start, y);
+                    int end = start + 1;
+                    while (end < w && heights[end] && label(end, y) == key) end++;
+
+                    stack.clear();
+                    for (int x = start; x <= end; x++) {
+                        int barTop = x < end ? heights[x] : 0;
+                        while (!stack.empty() && heights[stack.back()] >= barTop) {
+                            int barHeight = heights[stack.back()];
+                            stack.pop_back();
+                            if (barHeight == barTop) continue;
+                            int left = stack.empty() ? start : stack.back() + 1;
+                            int width = x - left;
+                            int spanX = std::min(width, maxSpan);
+                            for (int tx = left; tx + spanX <= x; tx += spanX)
+                                candidates.push_back({ barHeight * spanX, tx, y - barHeight + 1, spanX, barHeight });
+                        }
+                        stack.push_back(x);
+                    }
+
+                    start = end;
+                }
+            }
+
+            if (cancel.cancelled()) return;
+            std::stable_sort(candidates.begin(), candidates.end(), [](Candidate const& a, Candidate const& b) {
+                return a.area > b.area;
+            });
+
+            for (auto const& c : candidates) {
+                bool free = true;
+                for (int dy = 0; dy < c.spanY && free; dy++)
+                    free = covered.nextSet(c.y + dy, c.x, c.x + c.spanX) == c.x + c.spanX;
+                if (!free) continue;
+
+                covered.fillRect(c.x, c.y, c.spanX, c.spanY);
+                remaining -= c.area;
+                out.push_back({ x0 + c.x, y0 + c.y, c.spanX, c.spanY, 0 });
+            }
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <itb/Merge.hpp>
+
+#include <vector>
+
+namespace itb {
+    // Covers every cell labelled `only` (or every cell with a label >= 0 when `only` is negative)
+    // inside the window [x0, x0 + w) x [y0, y0 + h) of a gridWidth-wide label map with blocks that
+    // never mix labels. Each sweep runs the histogram/stack maximal-rectangle search over the
+    // window's rows and keeps the largest non-overlapping candidates, until nothing is left.
+    // Blocks are appended to `out` in grid coordinates with colour 0 for the caller to paint. Stops
+    // early, leaving cells uncovered, once `cancel` fires.
+    void coverLabels(std::vector<int> const& labels, int gridWidth, int x0, int y0, int w, int h, int only,
+        int maxSpan, CancelToken const& cancel, std::vector<MergeRect>& out);
+}
@@ -0,0 +1,26 @@
+#include "RunRows.hpp"
+
+#include <algorithm>
+
+namespace itb {
+    RunRows::RunRows(SampleGrid const& grid) : m_width(grid.width), m_height(grid.height) {
+        m_rowStart.reserve(size_t(m_height) + 1);
+        for (int y = 0; y < m_height; y++) {
+            m_rowStart.push_back(m_runs.size());
+            uint32_t const* row = &grid.cells[size_t(y) * m_width];
+            for (int x = 0; x < m_width;) {
+                int end = x + 1;
+                while (end < m_width && row[end] == row[x]) end++;
+                m_runs.push_back({ x, end - x, row[x] });
+                x = end;
+            }
+        }
+        m_rowStart.push_back(m_runs.size());
+    }
+
+    Run const* RunRows::find(int y, int x) const {
+        return std::upper_bound(this->rowBegin(y), this->rowEnd(y), x, [](int value, Run const& run) {
+            return value < run.start;
+        }) - 1;
+    }
+}
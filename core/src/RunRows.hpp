@@ -0,0 +1,36 @@
+#pragma once
+
+#include <itb/SampleGrid.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace itb {
+    // One horizontal run of identical packed cells.
+    struct Run {
+        int start, length;
+        uint32_t color;
+    };
+
+    // Run-length view of a sample grid, built in one pass: each row is a list of runs, so flat art
+    // costs time per run instead of per cell.
+    class RunRows {
+    public:
+        explicit RunRows(SampleGrid const& grid);
+
+        int getWidth() const { return m_width; }
+        int getHeight() const { return m_height; }
+        size_t getRunCount() const { return m_runs.size(); }
+
+        Run const* rowBegin(int y) const { return m_runs.data() + m_rowStart[y]; }
+        Run const* rowEnd(int y) const { return m_runs.data() + m_rowStart[y + 1]; }
+        // Run of row y that contains column x.
+        Run const* find(int y, int x) const;
+
+    private:
+        int m_width;
+        int m_height;
+        std::vector<Run> m_runs;
+        std::vector<size_t> m_rowStart;
+    };
+}
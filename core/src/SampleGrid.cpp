@@ -0,0 +1,62 @@
+#include <itb/SampleGrid.hpp>
+
+#include "AreaSampler.hpp"
+
+#include <itb/Parallel.hpp>
+
+#include <algorithm>
+
+namespace itb {
+    SampleGrid sampleGrid(Image const& image, int step) {
+        return sampleGridReduced(image, image.width, image.height, step, 1);
+    }
+
+    SampleGrid sampleGridReduced(Image const& reduced, int width, int height, int step, int scale) {
+        step = std::max(1, step);
+        SampleGrid grid;
+        grid.width = (width + step - 1) / step;
+        grid.height = (height + step - 1) / step;
+        grid.cells.resize((size_t)grid.width * grid.height);
+
+        for (int gy = 0; gy < grid.height; gy++) {
+            unsigned char const* row = &reduced.pixels[(size_t)(gy * step / scale) * reduced.width * 4];
+            uint32_t* out = &grid.cells[(size_t)gy * grid.width];
+            for (int gx = 0; gx < grid.width; gx++) {
+                unsigned char const* p = row + (size_t)(gx * step / scale) * 4;
+                out[gx] = packRGBA(p[0], p[1], p[2], p[3]);
+            }
+        }
+        return grid;
+    }
+
+    SampleGrid averageGrid(Image const& image, int step) {
+        if (step <= 1) return sampleGrid(image, 1);
+
+        SampleGrid grid;
+        grid.width = (image.width + step - 1) / step;
+        grid.height = (image.height + step - 1) / step;
+        grid.cells.resize((size_t)grid.width * grid.height);
+
+        parallelFor(grid.height, [&](int begin, int end) {
+            AreaAccumulator accumulator(image.width, step);
+            for (int gy = begin; gy < end; gy++) {
+                int y1 = std::min(image.height, (gy + 1) * step);
+                for (int y = gy * step; y < y1; y++) accumulator.addRow(&image.pixels[(size_t)y * image.width * 4]);
+                accumulator.finish(&grid.cells[(size_t)gy * grid.width]);
+            }
+        }, std::max(1, 64 / step));
+        return grid;
+    }
+
+    Image gridToImage(SampleGrid const& grid) {
+        Image image { grid.width, grid.height, std::vector<unsigned char>(grid.cells.size() * 4) };
+        for (size_t i = 0; i < grid.cells.size(); i++) {
+            uint32_t cell = grid.cells[i];
+            image.pixels[i * 4] = (unsigned char)cellRed(cell);
+            image.pixels[i * 4 + 1] = (unsigned char)cellGreen(cell);
+            image.pixels[i * 4 + 2] = (unsigned char)cellBlue(cell);
+            image.pixels[i * 4 + 3] = (unsigned char)cellAlpha(cell);
+        }
+        return image;
+    }
+}
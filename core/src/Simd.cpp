@@ -0,0 +1,87 @@
+#include <itb/Simd.hpp>
+
+#include "SimdTargets.hpp"
+
+#include <atomic>
+
+#if ITB_X86
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+namespace itb {
+    namespace {
+#if ITB_X86
+        bool cpuHasAvx2() {
+            unsigned regs[4] = {};
+    #if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 1);
+            regs[2] = info[2];
+    #else
+            __get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+    #endif
+            bool osxsave = regs[2] & (1u << 27);
+            bool avx = regs[2] & (1u << 28);
+            if (!osxsave || !avx) return false;
+
+    #if defined(_MSC_VER)
+            unsigned long long xcr0 = _xgetbv(0);
+    #else
+            unsigned eax, edx;
+            __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+    #endif
+            if ((xcr0 & 6) != 6) return false;
+
+    #if defined(_MSC_VER)
+            __cpuidex(info, 7, 0);
+            regs[1] = info[1];
+    #else
+            __get_cpuid_count(7, 0, &regs[0], &regs[1], &regs[2], &regs[3]);
+    #endif
+            return regs[1] & (1u << 5);
+        }
+#endif
+
+        SimdLevel detectSimdLevel() {
+#if ITB_X86
+            return cpuHasAvx2() ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#elif ITB_NEON
+            return SimdLevel::NEON;
+#else
+            return SimdLevel::Scalar;
+#endif
+        }
+
+        SimdLevel const maxLevel = detectSimdLevel();
+        std::atomic<SimdLevel> activeLevel{maxLevel};
+    }
+
+    SimdLevel getSimdLevel() {
+        return activeLevel.load(std::memory_order_relaxed);
+    }
+
+    SimdLevel getMaxSimdLevel() {
+        return maxLevel;
+    }
+
+    void setSimdLevel(SimdLevel level) {
+        bool supported = level == SimdLevel::Scalar || level == maxLevel ||
+            (level == SimdLevel::SSE2 && maxLevel == SimdLevel::AVX2);
+        activeLevel.store(supported ? level : maxLevel, std::memory_order_relaxed);
+    }
+
+    char const* simdLevelName(SimdLevel level) {
+        switch (level) {
+            case SimdLevel::Scalar: return "scalar";
+            case SimdLevel::SSE2: return "sse2";
+            case SimdLevel::AVX2: return "avx2";
+            case SimdLevel::NEON: return "neon";
+        }
+        return "unknown";
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Compile-time view of which SIMD kernels can be built for this target. AVX2 kernels are compiled
+// with a per-function target attribute and only called after a runtime check (see Simd.cpp).
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define ITB_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #define ITB_TARGET_AVX2
+    #else
+        #define ITB_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#else
+    #define ITB_X86 0
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+    #define ITB_NEON 1
+    #include <arm_neon.h>
+#else
+    #define ITB_NEON 0
+#endif
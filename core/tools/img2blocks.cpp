@@ -0,0 +1,248 @@
+#include <itb/Budget.hpp>
+#include <itb/Parallel.hpp>
+#include <itb/Pipeline.hpp>
+#include <itb/Quantize.hpp>
+#include <itb/Simd.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <sys/resource.h>
+
+namespace {
+    void printUsage() {
+        std::fprintf(stderr,
+            "usage: img2blocks <image> [options] > out.txt\n"
+            "  --step N      sample every N pixels (default: smart safety step)\n"
+            "  --tol N       per-channel merge tolerance (default: 5)\n"
+            "  --scale F     visual scale of one cell (default: 0.1)\n"
+            "  --merge       merge similar cells into larger blocks (default)\n"
+            "  --no-merge    emit one block per cell\n"
+            "  --sample M    cell colour: average (default) or point\n"
+            "  --max-span N  longest block edge in cells (default: from --scale and the editor's scale limit)\n"
+            "  --strategy S  merge strategy: greedy (default), largest, quadtree, budget or components\n"
+            "  --colors N    quantize to N colours (1-256) before merging (default: off)\n"
+            "  --dither D    with --colors: none (default), bayer, bluenoise or fs\n"
+            "  --metric M    tolerance metric: rgb (default), de76 or de2000\n"
+            "  --layers N    paint up to N common colours as overlapping background layers (default: 0)\n"
+            "  --budget N    pick the finest step, then the tolerance and strategy with the least colour\n"
+            "                error, that import in at most N objects (overrides --step, --tol, --strategy)\n"
+            "  --compare     report object count and RMS colour error of every merge strategy, with\n"
+            "                --layers also layered and the saving over disjoint blocks, and with\n"
+            "                --colors the speed and effect of every dither mode\n"
+        );
+    }
+
+    double msSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char** argv) {
+    char const* input = nullptr;
+    itb::ImportSettings settings;
+    settings.step = 0;
+    bool compare = false;
+    long long budget = 0;
+
+    for (int i = 1; i < argc; i++) {
+        char const* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (!std::strcmp(arg, "--step") && hasValue) settings.step = std::atoi(argv[++i]);
+        else if (!std::strcmp(arg, "--tol") && hasValue) settings.tolerance = std::atoi(argv[++i]);
+        else if (!std::strcmp(arg, "--scale") && hasValue) settings.visualScale = (float)std::atof(argv[++i]);
+        else if (!std::strcmp(arg, "--colors") && hasValue) {
+            char const* value = argv[++i];
+            char* end = nullptr;
+            long colors = std::strtol(value, &end, 10);
+            if (end == value || *end || colors < 1 || colors > itb::kMaxPaletteSize) {
+                printUsage();
+                return 2;
+            }
+            settings.paletteSize = int(colors);
+        }
+        else if (!std::strcmp(arg, "--max-span") && hasValue) settings.maxSpan = std::atoi(argv[++i]);
+        else if (!std::strcmp(arg, "--layers") && hasValue) settings.layers = std::max(0, std::atoi(argv[++i]));
+        else if (!std::strcmp(arg, "--merge")) settings.merge = true;
+        else if (!std::strcmp(arg, "--no-merge")) settings.merge = false;
+        else if (!std::strcmp(arg, "--sample") && hasValue) {
+            char const* mode = argv[++i];
+            if (!std::strcmp(mode, "point")) settings.sampling = itb::SampleMode::Point;
+            else if (!std::strcmp(mode, "average")) settings.sampling = itb::SampleMode::Average;
+            else {
+                printUsage();
+                return 2;
+            }
+        }
+        else if (!std::strcmp(arg, "--strategy") && hasValue) {
+            char const* strategy = argv[++i];
+            if (!std::strcmp(strategy, "greedy")) settings.strategy = itb::MergeMode::Greedy;
+            else if (!std::strcmp(strategy, "largest")) settings.strategy = itb::MergeMode::LargestFirst;
+            else if (!std::strcmp(strategy, "quadtree")) settings.strategy = itb::MergeMode::Quadtree;
+            else if (!std::strcmp(strategy, "budget")) settings.strategy = itb::MergeMode::ErrorBudget;
+            else if (!std::strcmp(strategy, "components")) settings.strategy = itb::MergeMode::Components;
+            else {
+                printUsage();
+                return 2;
+            }
+        }
+        else if (!std::strcmp(arg, "--metric") && hasValue) {
+            char const* metric = argv[++i];
+            if (!std::strcmp(metric, "rgb")) settings.metric = itb::ColorMetric::RGB;
+            else if (!std::strcmp(metric, "de76")) settings.metric = itb::ColorMetric::DeltaE76;
+            else if (!std::strcmp(metric, "de2000")) settings.metric = itb::ColorMetric::DeltaE2000;
+            else {
+                printUsage();
+                return 2;
+            }
+        }
+        else if (!std::strcmp(arg, "--dither") && hasValue) {
+            char const* dither = argv[++i];
+            if (!std::strcmp(dither, "none")) settings.dither = itb::DitherMode::None;
+            else if (!std::strcmp(dither, "bayer")) settings.dither = itb::DitherMode::Bayer;
+            else if (!std::strcmp(dither, "bluenoise")) settings.dither = itb::DitherMode::BlueNoise;
+            else if (!std::strcmp(dither, "fs")) settings.dither = itb::DitherMode::FloydSteinberg;
+            else {
+                printUsage();
+                return 2;
+            }
+        }
+        else if (!std::strcmp(arg, "--budget") && hasValue) budget = std::atoll(argv[++i]);
+        else if (!std::strcmp(arg, "--compare")) compare = true;
+        else if (arg[0] != '-' && !input) input = arg;
+        else {
+            printUsage();
+            return 2;
+        }
+    }
+    if (!input) {
+        printUsage();
+        return 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto info = itb::probeImageFile(input);
+    if (!info) {
+        std::fprintf(stderr, "img2blocks: unsupported image %s\n", input);
+        return 1;
+    }
+    double probeMs = msSince(start);
+
+    auto handle = itb::openImage(input);
+    start = std::chrono::steady_clock::now();
+    if (!handle->getBytes()) {
+        std::fprintf(stderr, "img2blocks: cannot read %s\n", input);
+        return 1;
+    }
+    double readMs = msSince(start);
+
+    if (budget > 0) {
+        start = std::chrono::steady_clock::now();
+        auto solved = itb::solveObjectBudget(*handle, settings, size_t(budget));
+        if (!solved) {
+            std::fprintf(stderr, "img2blocks: cannot decode %s\n", input);
+            return 1;
+        }
+        settings = solved->settings;
+        std::fprintf(stderr, "budget %lld: step %d, tol %d, %s, %zu Objects, RMSE %.2f, solved in %.2f ms\n",
+            budget, settings.step, settings.tolerance, settings.merge ? itb::mergeModeName(settings.strategy) : "No Merge",
+            solved->objects, solved->error, msSince(start));
+    }
+    if (settings.step <= 0) settings.step = itb::calculateSafeStep(info->width, info->height);
+
+    start = std::chrono::steady_clock::now();
+    auto grid = handle->getSampleGrid(settings.step, settings.sampling);
+    if (!grid) {
+        std::fprintf(stderr, "img2blocks: cannot decode %s\n", input);
+        return 1;
+    }
+    double decodeMs = msSince(start);
+
+    // Merges run on the quantized grid when a palette is set; errors are measured against `grid`.
+    start = std::chrono::steady_clock::now();
+    auto merged = grid;
+    if (settings.paletteSize > 0) merged = std::make_shared<const itb::SampleGrid>(itb::quantizeGrid(*grid, settings.paletteSize, settings.dither));
+    double quantizeMs = msSince(start);
+
+    start = std::chrono::steady_clock::now();
+    // --compare runs every strategy, so it always needs the tables.
+    std::shared_ptr<const itb::IntegralImage> integral;
+    if (!compare && !itb::mergeUsesIntegral(*merged, settings)) integral = std::make_shared<const itb::IntegralImage>();
+    else if (settings.paletteSize > 0) integral = std::make_shared<const itb::IntegralImage>(*merged);
+    else integral = handle->getIntegralImage(settings.step, settings.sampling);
+    double tableMs = msSince(start);
+
+    start = std::chrono::steady_clock::now();
+    auto blocks = itb::buildBlocks(*merged, *integral, settings);
+    double mergeMs = msSince(start);
+
+    start = std::chrono::steady_clock::now();
+    auto level = itb::buildLevelString(blocks, 0.0f, 0.0f);
+    double stringMs = msSince(start);
+
+    std::cout << level;
+
+    int maxSpan = settings.maxSpan > 0 ? settings.maxSpan : itb::calculateMaxSpan(settings.visualScale);
+    std::fprintf(stderr, "%dx%d (%dch, %d-bit) | Step: %d | Max Span: %d | %zu Objects (%s, %s)\n",
+        info->width, info->height, info->channels, info->bitDepth, settings.step, maxSpan, blocks.size(),
+        settings.merge ? itb::mergeModeName(settings.strategy) : "No Merge", itb::colorMetricName(settings.metric));
+    std::fprintf(stderr, "simd %s, %d threads\n", itb::simdLevelName(itb::getSimdLevel()), itb::getThreadCount());
+    std::fprintf(stderr, "probe %.2f ms, read %.2f ms, decode %.2f ms, quantize %.2f ms, tables %.2f ms, merge %.2f ms, string %.2f ms\n",
+        probeMs, readMs, decodeMs, quantizeMs, tableMs, mergeMs, stringMs);
+
+    if (compare) {
+        auto params = itb::getMergeParams(settings);
+        for (auto mode : { itb::MergeMode::Greedy, itb::MergeMode::LargestFirst, itb::MergeMode::Quadtree, itb::MergeMode::ErrorBudget,
+            itb::MergeMode::Components }) {
+            start = std::chrono::steady_clock::now();
+            auto strategy = itb::createMergeStrategy(mode);
+            auto rects = strategy->merge(*merged, *integral, params);
+            double ms = msSince(start);
+            std::fprintf(stderr, "  %-14s %8zu Objects  RMSE %6.2f  %.2f ms\n",
+                itb::mergeModeName(mode), rects.size(), itb::measureMergeError(*grid, rects), ms);
+            if (settings.layers <= 0) continue;
+
+            start = std::chrono::steady_clock::now();
+            auto layered = itb::mergeLayered(*strategy, *merged, *integral, params, settings.layers);
+            ms = msSince(start);
+            int layers = 0;
+            for (auto const& rect : layered) layers = std::max(layers, rect.z);
+            std::fprintf(stderr, "  %-14s %8zu Objects  RMSE %6.2f  %.2f ms  (%d layers, %.1f%% fewer)\n",
+                "  + layers", layered.size(), itb::measureMergeError(*grid, layered), ms, layers,
+                rects.empty() ? 0.0 : 100.0 * (1.0 - double(layered.size()) / rects.size()));
+        }
+    }
+
+    if (compare && settings.paletteSize > 0) {
+        // Ordered modes are timed at every SIMD level; errors are against the unquantized grid.
+        auto maxLevel = itb::getMaxSimdLevel();
+        double cells = double(grid->width) * grid->height;
+        auto params = itb::getMergeParams(settings);
+        for (auto dither : { itb::DitherMode::None, itb::DitherMode::Bayer, itb::DitherMode::BlueNoise, itb::DitherMode::FloydSteinberg }) {
+            bool ordered = dither == itb::DitherMode::Bayer || dither == itb::DitherMode::BlueNoise;
+            for (auto level : { itb::SimdLevel::Scalar, itb::SimdLevel::SSE2, itb::SimdLevel::AVX2, itb::SimdLevel::NEON }) {
+                itb::setSimdLevel(level);
+                if (itb::getSimdLevel() != level || (!ordered && level != maxLevel)) continue;
+                itb::quantizeGrid(*grid, settings.paletteSize, dither);
+                start = std::chrono::steady_clock::now();
+                auto dithered = itb::quantizeGrid(*grid, settings.paletteSize, dither);
+                double ms = msSince(start);
+                auto rects = itb::createMergeStrategy(settings.strategy)->merge(dithered, itb::IntegralImage(dithered), params);
+                std::fprintf(stderr, "  %-15s %-6s %8.2f ms %8.1f Mcells/s %8zu Objects  RMSE %6.2f\n",
+                    itb::ditherModeName(dither), itb::simdLevelName(level), ms, cells / ms / 1000.0,
+                    rects.size(), itb::measureMergeError(*grid, rects));
+            }
+        }
+        itb::setSimdLevel(maxLevel);
+    }
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    std::fprintf(stderr, "peak memory %.1f MB\n", usage.ru_maxrss / 1024.0);
+    return 0;
+}
@@ -0,0 +1,326 @@
+// Microbenchmarks for merge engine internals that the img2blocks timings are too coarse to show.
+
+#include "CoverageMap.hpp"
+#include "MatchPolicy.hpp"
+
+#include <itb/Image.hpp>
+#include <itb/IntegralImage.hpp>
+#include <itb/Merge.hpp>
+#include <itb/Parallel.hpp>
+#include <itb/Simd.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+namespace {
+    void printUsage() {
+        std::fprintf(stderr,
+            "usage: itb-bench <benchmark> [options]\n"
+            "  coverage [--size N]   greedy-style block marking on an N x N grid (default: 1000),\n"
+            "                        std::vector<bool> against the bitset CoverageMap\n"
+            "  scan [--size N]       horizontal run scans of the exact and per-channel match policies\n"
+            "                        on an N x N grid at every SIMD level this CPU supports\n"
+            "  threads [--size N]    tiled greedy merge of an N x N grid (default: 4000) on 1-16 threads,\n"
+            "                        checking that every thread count gives the same blocks\n"
+            "  jpeg FILE...          reduced-IDCT JPEG decodes against the full stb decode, sampled at\n"
+            "                        steps 2-16, failing if an averaged grid drifts from the full one\n"
+        );
+    }
+
+    double msSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Keeps benchmarked results observable so the work can't be optimized away.
+    volatile long long g_sink;
+
+    template <class Fn>
+    double bestOf(int runs, Fn&& fn) {
+        double best = 1e300;
+        for (int i = 0; i < runs; i++) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            best = std::min(best, msSince(start));
+        }
+        return best;
+    }
+
+    struct Lcg {
+        uint32_t state = 12345;
+
+        uint32_t next(uint32_t range) {
+            state = state * 1664525u + 1013904223u;
+            return (state >> 16) % range;
+        }
+    };
+
+    // Deterministic block sizes, so both coverage structures see the same sequence of decisions.
+    struct BlockSizes {
+        uint32_t state = 12345;
+        int maxSpan;
+
+        int next() {
+            state = state * 1664525u + 1013904223u;
+            return 1 + int((state >> 16) % uint32_t(maxSpan));
+        }
+    };
+
+    // The scan GreedyMerge used to run: skip visited cells one at a time, probe the row for a free
+    // stretch, mark the block cell by cell.
+    long long scanVectorBool(int size, int maxSpan) {
+        std::vector<bool> visited(size_t(size) * size, false);
+        BlockSizes sizes { .maxSpan = maxSpan };
+        long long blocks = 0;
+        for (int gy = 0; gy < size; gy++) {
+            for (int gx = 0; gx < size; gx++) {
+                size_t idx = size_t(gy) * size + gx;
+                if (visited[idx]) continue;
+                int wantX = sizes.next(), wantY = sizes.next();
+                int spX = 1;
+                while (gx + spX < size && spX < wantX && !visited[idx + spX]) spX++;
+                int spY = std::min(wantY, size - gy);
+                for (int dy = 0; dy < spY; dy++)
+                    for (int dx = 0; dx < spX; dx++)
+                        visited[idx + size_t(dy) * size + dx] = true;
+                blocks++;
+            }
+        }
+        return blocks;
+    }
+
+    long long scanCoverageMap(int size, int maxSpan) {
+        itb::CoverageMap visited(size, size);
+        BlockSizes sizes { .maxSpan = maxSpan };
+        long long blocks = 0;
+        for (int gy = 0; gy < size; gy++) {
+            for (int gx = visited.nextClear(gy, 0); gx < size; gx = visited.nextClear(gy, gx + 1)) {
+                int wantX = sizes.next(), wantY = sizes.next();
+                int spX = visited.nextSet(gy, gx + 1, std::min(size, gx + wantX)) - gx;
+                int spY = std::min(wantY, size - gy);
+                visited.fillRect(gx, gy, spX, spY);
+                blocks++;
+            }
+        }
+        return blocks;
+    }
+
+    int benchCoverage(int size) {
+        std::printf("coverage %dx%d, best of 10\n", size, size);
+        std::printf("%8s %10s %14s %14s %8s\n", "max span", "blocks", "vector<bool>", "CoverageMap", "speedup");
+        for (int maxSpan : { 1, 4, 20, 64 }) {
+            long long expected = scanVectorBool(size, maxSpan);
+            if (scanCoverageMap(size, maxSpan) != expected) {
+                std::fprintf(stderr, "coverage: block counts differ at max span %d\n", maxSpan);
+                return 1;
+            }
+            double before = bestOf(10, [&] { g_sink = scanVectorBool(size, maxSpan); });
+            double after = bestOf(10, [&] { g_sink = scanCoverageMap(size, maxSpan); });
+            std::printf("%8d %10lld %11.2f ms %11.2f ms %7.1fx\n", maxSpan, expected, before, after, before / after);
+        }
+        return 0;
+    }
+
+    // Rows of runs 1-64 cells long, each a random opaque colour with every cell jittered by up to
+    // +-jitter per channel, plus a sprinkle of transparent cells.
+    itb::SampleGrid makeRunGrid(int size, int jitter) {
+        itb::SampleGrid grid { size, size, std::vector<uint32_t>(size_t(size) * size) };
+        Lcg rng;
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size;) {
+                int length = 1 + int(rng.next(64));
+                int r = 16 + int(rng.next(224)), g = 16 + int(rng.next(224)), b = 16 + int(rng.next(224));
+                for (int end = std::min(size, x + length); x < end; x++) {
+                    auto channel = [&](int v) { return uint32_t(v + int(rng.next(2 * jitter + 1)) - jitter); };
+                    uint32_t alpha = rng.next(100) ? 255 : 100;
+                    grid.cells[size_t(y) * size + x] = itb::packRGBA(channel(r), channel(g), channel(b), alpha);
+                }
+            }
+        }
+        return grid;
+    }
+
+    // Greedy-style horizontal extension across every row: from each start, scan to the end of its run.
+    template <class Policy>
+    long long scanRows(Policy const& policy, int size, int maxSpan) {
+        long long total = 0;
+        for (int y = 0; y < size; y++) {
+            int row = y * size;
+            for (int x = 0; x < size;) {
+                int end = policy.runEnd(row + x + 1, row + std::min(size, x + maxSpan), row + x);
+                total += end - row;
+                x = end - row;
+            }
+        }
+        return total;
+    }
+
+    int benchScan(int size) {
+        auto exactGrid = makeRunGrid(size, 0);
+        auto channelGrid = makeRunGrid(size, 2);
+        auto maxLevel = itb::getMaxSimdLevel();
+        double cells = double(size) * size;
+
+        std::printf("run scan %dx%d, best of 10\n", size, size);
+        std::printf("%-8s %8s %-8s %10s %12s\n", "policy", "max span", "simd", "ms", "Mcells/s");
+        for (int maxSpan : { 20, 256 }) {
+            long long exactExpected = -1, channelExpected = -1;
+            for (auto level : { itb::SimdLevel::Scalar, itb::SimdLevel::SSE2, itb::SimdLevel::AVX2, itb::SimdLevel::NEON }) {
+                itb::setSimdLevel(level);
+                if (itb::getSimdLevel() != level) continue;
+
+                itb::ExactMatch exact(exactGrid);
+                itb::ChannelMatch channel(channelGrid, 5);
+                long long exactTotal = scanRows(exact, size, maxSpan), channelTotal = scanRows(channel, size, maxSpan);
+                if (exactExpected < 0) {
+                    exactExpected = exactTotal;
+                    channelExpected = channelTotal;
+                }
+                if (exactTotal != exactExpected || channelTotal != channelExpected) {
+                    std::fprintf(stderr, "scan: %s kernels disagree with scalar\n", itb::simdLevelName(level));
+                    itb::setSimdLevel(maxLevel);
+                    return 1;
+                }
+
+                double exactMs = bestOf(10, [&] { g_sink = scanRows(exact, size, maxSpan); });
+                double channelMs = bestOf(10, [&] { g_sink = scanRows(channel, size, maxSpan); });
+                std::printf("%-8s %8d %-8s %10.2f %12.1f\n", "exact", maxSpan, itb::simdLevelName(level), exactMs, cells / exactMs / 1000.0);
+                std::printf("%-8s %8d %-8s %10.2f %12.1f\n", "channel", maxSpan, itb::simdLevelName(level), channelMs, cells / channelMs / 1000.0);
+            }
+        }
+        itb::setSimdLevel(maxLevel);
+        return 0;
+    }
+
+    // Largest mean per-channel difference an averaged grid may have from the full decode's. The
+    // reduced IDCT only rounds and clamps differently from stb's full-size one.
+    constexpr double kMaxJpegMeanError = 1.0;
+
+    struct GridError {
+        double mean = 0;
+        int max = 0;
+    };
+
+    GridError compareGrids(itb::SampleGrid const& a, itb::SampleGrid const& b) {
+        GridError error;
+        long long total = 0;
+        for (size_t i = 0; i < a.cells.size(); i++) {
+            for (int shift = 0; shift < 24; shift += 8) {
+                int diff = std::abs(int((a.cells[i] >> shift) & 0xff) - int((b.cells[i] >> shift) & 0xff));
+                total += diff;
+                error.max = std::max(error.max, diff);
+            }
+        }
+        error.mean = a.cells.empty() ? 0.0 : double(total) / (3.0 * a.cells.size());
+        return error;
+    }
+
+    int benchJpeg(std::vector<char const*> const& files) {
+        std::printf("%-24s %6s %-8s %10s %8s %6s %10s %10s\n", "file", "step", "mode", "grid", "mean", "max", "full ms", "reduced ms");
+        bool failed = false;
+        for (char const* file : files) {
+            auto data = itb::readFile(file);
+            auto full = data ? itb::decodeImage(*data) : std::nullopt;
+            if (!full) {
+                std::fprintf(stderr, "jpeg: cannot decode %s\n", file);
+                return 1;
+            }
+            char const* name = std::strrchr(file, '/') ? std::strrchr(file, '/') + 1 : file;
+            for (int step : { 2, 3, 4, 6, 8, 16 }) {
+                for (auto mode : { itb::SampleMode::Point, itb::SampleMode::Average }) {
+                    bool average = mode == itb::SampleMode::Average;
+                    itb::SampleGrid expected;
+                    double fullMs = bestOf(3, [&] {
+                        auto image = itb::decodeImage(*data);
+                        expected = average ? itb::averageGrid(*image, step) : itb::sampleGrid(*image, step);
+                    });
+                    std::optional<itb::SampleGrid> grid;
+                    double reducedMs = bestOf(3, [&] { grid = itb::decodeSampled(*data, step, mode); });
+                    if (!grid || grid->width != expected.width || grid->height != expected.height) {
+                        std::fprintf(stderr, "jpeg: %s at step %d gives a different grid size\n", name, step);
+                        return 1;
+                    }
+                    auto error = compareGrids(*grid, expected);
+                    bool drifted = average && error.mean > kMaxJpegMeanError;
+                    failed |= drifted;
+                    std::printf("%-24s %6d %-8s %4dx%-5d %8.2f %6d %10.2f %10.2f%s\n", name, step, average ? "average" : "point",
+                        grid->width, grid->height, error.mean, error.max, fullMs, reducedMs, drifted ? "  FAIL" : "");
+                }
+            }
+        }
+        if (failed) std::fprintf(stderr, "jpeg: averaged grids drift more than %.1f from the full decode\n", kMaxJpegMeanError);
+        return failed ? 1 : 0;
+    }
+
+    bool sameRects(std::vector<itb::MergeRect> const& a, std::vector<itb::MergeRect> const& b) {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](itb::MergeRect const& l, itb::MergeRect const& r) {
+            return l.x == r.x && l.y == r.y && l.spanX == r.spanX && l.spanY == r.spanY && l.color == r.color;
+        });
+    }
+
+    int benchThreads(int size) {
+        auto greedy = itb::createMergeStrategy(itb::MergeMode::Greedy);
+        itb::MergeParams params;
+        std::printf("tiled greedy merge %dx%d, best of 3\n", size, size);
+        std::printf("%-6s %8s %10s %10s %8s\n", "grid", "threads", "blocks", "ms", "speedup");
+        // Flat runs take the run-length path, jittered ones the cell scan.
+        for (int jitter : { 0, 2 }) {
+            auto grid = makeRunGrid(size, jitter);
+            itb::IntegralImage integral(grid);
+            std::vector<itb::MergeRect> expected;
+            double single = 0;
+            for (int threads : { 1, 2, 4, 8, 16 }) {
+                itb::setThreadCount(threads);
+                auto rects = greedy->merge(grid, integral, params);
+                if (threads == 1) expected = rects;
+                else if (!sameRects(rects, expected)) {
+                    std::fprintf(stderr, "threads: %d threads changed the output\n", threads);
+                    itb::setThreadCount(0);
+                    return 1;
+                }
+                double ms = bestOf(3, [&] { g_sink = (long long)greedy->merge(grid, integral, params).size(); });
+                if (threads == 1) single = ms;
+                std::printf("%-6s %8d %10zu %10.2f %7.2fx\n", jitter ? "noisy" : "flat", threads, rects.size(), ms, single / ms);
+            }
+        }
+        itb::setThreadCount(0);
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printUsage();
+        return 2;
+    }
+
+    char const* benchmark = argv[1];
+    int size = 0;
+    std::vector<char const*> files;
+    for (int i = 2; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--size") && i + 1 < argc) size = std::atoi(argv[++i]);
+        else if (argv[i][0] != '-') files.push_back(argv[i]);
+        else {
+            printUsage();
+            return 2;
+        }
+    }
+    // Only the jpeg check takes files, and it needs at least one.
+    bool takesFiles = !std::strcmp(benchmark, "jpeg");
+    if (size < 0 || takesFiles == files.empty()) {
+        printUsage();
+        return 2;
+    }
+
+    if (!std::strcmp(benchmark, "coverage")) return benchCoverage(size ? size : 1000);
+    if (!std::strcmp(benchmark, "scan")) return benchScan(size ? size : 1000);
+    if (!std::strcmp(benchmark, "threads")) return benchThreads(size ? size : 4000);
+    if (!std::strcmp(benchmark, "jpeg")) return benchJpeg(files);
+    printUsage();
+    return 2;
+}
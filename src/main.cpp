@@ -10,43 +10,19 @@
 #include <Geode/binding/CCMenuItemSpriteExtra.hpp>
 #include <Geode/binding/ButtonSprite.hpp>
 
+#include <itb/ImageCache.hpp>
+#include <itb/Pipeline.hpp>
+#include <itb/Preview.hpp>
+
 #include <thread>
 #include <vector>
 #include <atomic>
-#include <cmath>
 #include <filesystem>
-#include <sstream>
-
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include <mutex>
+#include <optional>
 
 using namespace geode::prelude;
 
-struct GDHSV { float h, s, v; };
-struct BlockData {
-    float x, y;
-    int spanX, spanY;
-    float visualScale;
-    GDHSV hsv;
-    ccColor3B color;
-};
-
-GDHSV rgbToGdhsv(ccColor3B color) {
-    float r = color.r / 255.0f;
-    float g = color.g / 255.0f;
-    float b = color.b / 255.0f;
-    float max = std::max({r, g, b}), min = std::min({r, g, b});
-    float d = max - min, h = 0, s = (max > 0 ? d / max : 0), v = max;
-
-    if (max != min) {
-        if (max == r) h = (g - b) / d + (g < b ? 6 : 0);
-        else if (max == g) h = (b - r) / d + 2;
-        else h = (r - g) / d + 4;
-        h /= 6;
-    }
-    return { h * 360.0f, s, v };
-}
-
 class ImporterTutorialPopup : public Popup {
 protected:
     CCLayer* m_page1 = nullptr;
@@ -122,31 +98,92 @@ public:
 
 class ImportSettingsPopup : public Popup, public TextInputDelegate {
 protected:
+    // Seconds of quiet after an edit before the object count and preview are recomputed.
+    static constexpr float kEstimateDelay = 0.3f;
+    // The preview is merged on at most this many cells per side and drawn into a texture of at most
+    // this many pixels, shown kPreviewSize points wide.
+    static constexpr int kPreviewCells = 128;
+    static constexpr int kPreviewPixels = 512;
+    static constexpr float kPreviewSize = 130.f;
+
+    struct EstimateRequest {
+        itb::ImportSettings settings;
+        bool outlines;
+    };
+
+    // Live object count and preview. One worker at a time merges the newest settings; edits made
+    // while it runs replace them, and results for settings that changed since are dropped.
+    struct Estimator {
+        std::mutex mutex;
+        std::optional<EstimateRequest> pending;
+        bool running = false;
+        // Bumped on every edit; a result is only shown if nothing changed while it was computed.
+        std::atomic<int> generation{0};
+        // Main thread only. Cleared when the popup goes away, which a running worker may outlive.
+        ImportSettingsPopup* popup = nullptr;
+
+        // Worker only: the settings the last merges ran with, so edits that don't change them (like
+        // the outline toggle) only redraw.
+        std::optional<itb::ImportSettings> previewSettings;
+        itb::PreviewMerge preview;
+        std::optional<itb::ImportSettings> countSettings;
+        size_t count = 0;
+    };
+
     TextInput* m_stepInput = nullptr;
     TextInput* m_scaleInput = nullptr;
     TextInput* m_toleranceInput = nullptr;
+    TextInput* m_spanInput = nullptr;
+    TextInput* m_colorsInput = nullptr;
     CCLabelBMFont* m_infoLabel = nullptr;
     CCMenuItemToggler* m_resizeToggle = nullptr;
     CCMenuItemToggler* m_mergeToggle = nullptr;
+    CCMenuItemToggler* m_smoothToggle = nullptr;
+    CCMenuItemToggler* m_layerToggle = nullptr;
+    CCMenuItemToggler* m_outlineToggle = nullptr;
+    CCSprite* m_previewSprite = nullptr;
+    CCPoint m_previewCenter;
+    ButtonSprite* m_strategySprite = nullptr;
+    itb::MergeMode m_strategy = itb::MergeMode::Greedy;
+    ButtonSprite* m_metricSprite = nullptr;
+    itb::ColorMetric m_metric = itb::ColorMetric::RGB;
+    ButtonSprite* m_ditherSprite = nullptr;
+    itb::DitherMode m_dither = itb::DitherMode::None;
     
     std::filesystem::path m_filePath;
+    std::shared_ptr<itb::ImageHandle> m_image;
     int m_imageWidth = 0;
     int m_imageHeight = 0;
+    int m_imageChannels = 0;
+    int m_imageBitDepth = 8;
     std::atomic<bool> m_isProcessing{false};
+    std::shared_ptr<Estimator> m_estimator = std::make_shared<Estimator>();
+    // Last count shown and the edit generation it belongs to.
+    size_t m_estimate = 0;
+    int m_estimateGeneration = -1;
+
+    ~ImportSettingsPopup() override {
+        m_estimator->popup = nullptr;
+        m_estimator->generation++;
+    }
 
     bool init(std::filesystem::path path) {
         m_filePath = path;
-        if (!Popup::init(360.f, 260.f)) return false;
+        m_estimator->popup = this;
+        if (!Popup::init(500.f, 290.f)) return false;
         this->setTitle("Import Image Settings");
 
+        // Settings fill the left 360 points, the preview the rest.
         auto winSize = m_mainLayer->getContentSize();
-        float centerX = winSize.width / 2;
+        float centerX = 180;
         float topY = winSize.height - 45;
 
-        if (auto dataRes = file::readBinary(m_filePath)) {
-            auto rawData = dataRes.unwrap();
-            int ch;
-            stbi_info_from_memory(rawData.data(), (int)rawData.size(), &m_imageWidth, &m_imageHeight, &ch);
+        m_image = itb::openImage(m_filePath);
+        if (auto info = m_image->getInfo()) {
+            m_imageWidth = info->width;
+            m_imageHeight = info->height;
+            m_imageChannels = info->channels;
+            m_imageBitDepth = info->bitDepth;
         }
 
         m_infoLabel = CCLabelBMFont::create("Loading info...", "chatFont.fnt");
@@ -160,53 +197,80 @@ protected:
         float toggleY = descY - 40;
         float toggleLabelY = toggleY - 25;
 
-        m_mainLayer->addChild(createLabel("Step", {centerX - 90, headerY}));
-        m_stepInput = TextInput::create(60.0f, "0", "chatFont.fnt");
-        m_stepInput->setPosition({centerX - 90, inputY});
+        m_mainLayer->addChild(createLabel("Step", {centerX - 140, headerY}));
+        m_stepInput = TextInput::create(55.0f, "0", "chatFont.fnt");
+        m_stepInput->setPosition({centerX - 140, inputY});
         m_stepInput->setString("0");
         m_stepInput->setFilter("0123456789");
         m_stepInput->setDelegate(this);
         m_mainLayer->addChild(m_stepInput);
 
-        m_mainLayer->addChild(createLabel("Tol", {centerX, headerY}));
-        m_toleranceInput = TextInput::create(60.0f, "5", "chatFont.fnt");
-        m_toleranceInput->setPosition({centerX, inputY});
+        m_mainLayer->addChild(createLabel("Tol", {centerX - 70, headerY}));
+        m_toleranceInput = TextInput::create(55.0f, "5", "chatFont.fnt");
+        m_toleranceInput->setPosition({centerX - 70, inputY});
         m_toleranceInput->setString("5");
         m_toleranceInput->setFilter("0123456789");
         m_toleranceInput->setDelegate(this);
         m_mainLayer->addChild(m_toleranceInput);
 
-        m_mainLayer->addChild(createLabel("Scale", {centerX + 90, headerY}));
-        m_scaleInput = TextInput::create(60.0f, "0.1", "chatFont.fnt");
-        m_scaleInput->setPosition({centerX + 90, inputY});
+        m_mainLayer->addChild(createLabel("Scale", {centerX, headerY}));
+        m_scaleInput = TextInput::create(55.0f, "0.1", "chatFont.fnt");
+        m_scaleInput->setPosition({centerX, inputY});
         m_scaleInput->setString("0.1");
         m_scaleInput->setFilter("0123456789.");
         m_scaleInput->setDelegate(this);
         m_mainLayer->addChild(m_scaleInput);
 
+        m_mainLayer->addChild(createLabel("Span", {centerX + 70, headerY}));
+        m_spanInput = TextInput::create(55.0f, "Auto", "chatFont.fnt");
+        m_spanInput->setPosition({centerX + 70, inputY});
+        m_spanInput->setFilter("0123456789");
+        m_spanInput->setDelegate(this);
+        m_mainLayer->addChild(m_spanInput);
+
+        m_mainLayer->addChild(createLabel("Colors", {centerX + 140, headerY}));
+        m_colorsInput = TextInput::create(55.0f, "All", "chatFont.fnt");
+        m_colorsInput->setPosition({centerX + 140, inputY});
+        m_colorsInput->setFilter("0123456789");
+        m_colorsInput->setDelegate(this);
+        m_mainLayer->addChild(m_colorsInput);
+
         auto toggleMenu = CCMenu::create();
         toggleMenu->setPosition({centerX, toggleY});
 
         m_resizeToggle = CCMenuItemToggler::createWithStandardSprites(this, menu_selector(ImportSettingsPopup::onToggle), 0.6f);
         m_resizeToggle->toggle(true);
-        m_resizeToggle->setPosition({-60, 0});
+        m_resizeToggle->setPosition({-135, 0});
         toggleMenu->addChild(m_resizeToggle);
 
         m_mergeToggle = CCMenuItemToggler::createWithStandardSprites(this, menu_selector(ImportSettingsPopup::onToggle), 0.6f);
         m_mergeToggle->toggle(true);
-        m_mergeToggle->setPosition({60, 0});
+        m_mergeToggle->setPosition({45, 0});
         toggleMenu->addChild(m_mergeToggle);
+
+        m_smoothToggle = CCMenuItemToggler::createWithStandardSprites(this, menu_selector(ImportSettingsPopup::onToggle), 0.6f);
+        m_smoothToggle->toggle(true);
+        m_smoothToggle->setPosition({-45, 0});
+        toggleMenu->addChild(m_smoothToggle);
+
+        m_layerToggle = CCMenuItemToggler::createWithStandardSprites(this, menu_selector(ImportSettingsPopup::onToggle), 0.6f);
+        m_layerToggle->toggle(false);
+        m_layerToggle->setPosition({135, 0});
+        toggleMenu->addChild(m_layerToggle);
         m_mainLayer->addChild(toggleMenu);
 
-        m_mainLayer->addChild(createSmallLabel("Smart Safety", {centerX - 60, toggleLabelY}));
-        auto mergeLabel = createSmallLabel("Merge Blocks", {centerX + 60, toggleLabelY});
+        m_mainLayer->addChild(createSmallLabel("Smart Safety", {centerX - 135, toggleLabelY}));
+        m_mainLayer->addChild(createSmallLabel("Smooth Colors", {centerX - 45, toggleLabelY}));
+        auto mergeLabel = createSmallLabel("Merge Blocks", {centerX + 45, toggleLabelY});
         mergeLabel->setColor({150, 255, 150});
         m_mainLayer->addChild(mergeLabel);
 
-        auto mergeWarn = createSmallLabel("(High count = Lag)", {centerX + 60, toggleLabelY - 12});
+        auto mergeWarn = createSmallLabel("(High count = Lag)", {centerX + 45, toggleLabelY - 12});
         mergeWarn->setColor({255, 100, 100});
         m_mainLayer->addChild(mergeWarn);
 
+        m_mainLayer->addChild(createSmallLabel("Layers", {centerX + 135, toggleLabelY}));
+
         auto btnMenu = CCMenu::create();
         btnMenu->setPosition({centerX, 30});
         
@@ -220,10 +284,50 @@ protected:
             ButtonSprite::create("?", "goldFont.fnt", "GJ_button_02.png", 0.8f),
             this, menu_selector(ImportSettingsPopup::onHelp)
         );
-        helpBtn->setPosition({130, 90});
+        helpBtn->setPosition({130, 120});
         btnMenu->addChild(helpBtn);
 
+        m_strategySprite = ButtonSprite::create(itb::mergeModeName(m_strategy), "bigFont.fnt", "GJ_button_04.png", 0.5f);
+        m_strategySprite->setScale(0.6f);
+        auto strategyBtn = CCMenuItemSpriteExtra::create(
+            m_strategySprite, this, menu_selector(ImportSettingsPopup::onStrategy)
+        );
+        strategyBtn->setPosition({-120, 34});
+        btnMenu->addChild(strategyBtn);
+
+        m_metricSprite = ButtonSprite::create(itb::colorMetricName(m_metric), "bigFont.fnt", "GJ_button_04.png", 0.5f);
+        m_metricSprite->setScale(0.6f);
+        auto metricBtn = CCMenuItemSpriteExtra::create(
+            m_metricSprite, this, menu_selector(ImportSettingsPopup::onMetric)
+        );
+        metricBtn->setPosition({0, 34});
+        btnMenu->addChild(metricBtn);
+
+        m_ditherSprite = ButtonSprite::create(itb::ditherModeName(m_dither), "bigFont.fnt", "GJ_button_04.png", 0.5f);
+        m_ditherSprite->setScale(0.6f);
+        auto ditherBtn = CCMenuItemSpriteExtra::create(
+            m_ditherSprite, this, menu_selector(ImportSettingsPopup::onDither)
+        );
+        ditherBtn->setPosition({120, 34});
+        btnMenu->addChild(ditherBtn);
+
         m_mainLayer->addChild(btnMenu);
+
+        m_previewCenter = {winSize.width - 75, winSize.height / 2 + 10};
+        m_mainLayer->addChild(createLabel("Preview", {m_previewCenter.x, m_previewCenter.y + kPreviewSize / 2 + 14}));
+        auto previewFrame = CCLayerColor::create({0, 0, 0, 90}, kPreviewSize + 6, kPreviewSize + 6);
+        previewFrame->ignoreAnchorPointForPosition(false);
+        previewFrame->setPosition(m_previewCenter);
+        m_mainLayer->addChild(previewFrame);
+
+        auto outlineMenu = CCMenu::create();
+        outlineMenu->setPosition({m_previewCenter.x - 30, m_previewCenter.y - kPreviewSize / 2 - 22});
+        m_outlineToggle = CCMenuItemToggler::createWithStandardSprites(this, menu_selector(ImportSettingsPopup::onToggle), 0.5f);
+        m_outlineToggle->toggle(false);
+        outlineMenu->addChild(m_outlineToggle);
+        m_mainLayer->addChild(outlineMenu);
+        m_mainLayer->addChild(createSmallLabel("Outlines", {m_previewCenter.x + 10, m_previewCenter.y - kPreviewSize / 2 - 22}));
+
         this->updateStats();
 
         if (!Mod::get()->getSavedValue<bool>("shown-guide-v2", false)) {
@@ -256,127 +360,238 @@ protected:
     void onToggle(CCObject*) { this->updateStats(); }
     void onHelp(CCObject*) { this->showTutorialPopup(); }
 
-    void showTutorialPopup() {
-        ImporterTutorialPopup::create()->show();
+    void onStrategy(CCObject*) {
+        switch (m_strategy) {
+            case itb::MergeMode::Greedy: m_strategy = itb::MergeMode::LargestFirst; break;
+            case itb::MergeMode::LargestFirst: m_strategy = itb::MergeMode::Quadtree; break;
+            case itb::MergeMode::Quadtree: m_strategy = itb::MergeMode::ErrorBudget; break;
+            case itb::MergeMode::ErrorBudget: m_strategy = itb::MergeMode::Components; break;
+            default: m_strategy = itb::MergeMode::Greedy; break;
+        }
+        m_strategySprite->setString(itb::mergeModeName(m_strategy));
+        this->updateStats();
     }
 
-    int calculateSafeStep(int w, int h) {
-        int maxDim = std::max(w, h);
-        int step = (maxDim > 200) ? static_cast<int>(std::ceil(maxDim / 200.0f)) : 1;
-        long long total = (long long)w * h;
-        while ((total / (step * step)) > 10000) step++;
-        return step;
+    void onMetric(CCObject*) {
+        switch (m_metric) {
+            case itb::ColorMetric::RGB: m_metric = itb::ColorMetric::DeltaE76; break;
+            case itb::ColorMetric::DeltaE76: m_metric = itb::ColorMetric::DeltaE2000; break;
+            default: m_metric = itb::ColorMetric::RGB; break;
+        }
+        m_metricSprite->setString(itb::colorMetricName(m_metric));
+        this->updateStats();
     }
 
-    void updateStats() {
-        if (m_imageWidth == 0) return;
-        int step = m_resizeToggle->isToggled() ? calculateSafeStep(m_imageWidth, m_imageHeight) 
-                                               : std::max(1, utils::numFromString<int>(m_stepInput->getString()).unwrapOr(1));
-        int count = (m_imageWidth / step) * (m_imageHeight / step);
-        m_infoLabel->setString(fmt::format("{}x{} | Step: {}\n~{} Objects", m_imageWidth, m_imageHeight, step, count).c_str());
+    // Only takes effect when a palette size is set.
+    void onDither(CCObject*) {
+        switch (m_dither) {
+            case itb::DitherMode::None: m_dither = itb::DitherMode::Bayer; break;
+            case itb::DitherMode::Bayer: m_dither = itb::DitherMode::BlueNoise; break;
+            case itb::DitherMode::BlueNoise: m_dither = itb::DitherMode::FloydSteinberg; break;
+            default: m_dither = itb::DitherMode::None; break;
+        }
+        m_ditherSprite->setString(itb::ditherModeName(m_dither));
+        this->updateStats();
     }
 
-    void onImport(CCObject*) {
-        if (m_isProcessing.exchange(true)) return;
-
-        int step = m_resizeToggle->isToggled() ? calculateSafeStep(m_imageWidth, m_imageHeight) 
-                                               : std::max(1, utils::numFromString<int>(m_stepInput->getString()).unwrapOr(1));
-        float scale = utils::numFromString<float>(m_scaleInput->getString()).unwrapOr(0.1f);
-        int tolerance = utils::numFromString<int>(m_toleranceInput->getString()).unwrapOr(5);
+    void showTutorialPopup() {
+        ImporterTutorialPopup::create()->show();
+    }
 
-        this->processImageBackground(step, scale, tolerance, m_mergeToggle->isToggled());
-        this->onClose(nullptr);
+    int getStep() {
+        return m_resizeToggle->isToggled() ? itb::calculateSafeStep(m_imageWidth, m_imageHeight)
+                                           : std::max(1, utils::numFromString<int>(m_stepInput->getString()).unwrapOr(1));
     }
 
-    void processImageBackground(int step, float visualScale, int tolerance, bool shouldMerge) {
-        std::filesystem::path pathCopy = m_filePath;
-        std::thread([pathCopy, step, visualScale, tolerance, shouldMerge]() mutable {
-            auto dataRes = file::readBinary(pathCopy);
-            if (!dataRes) return;
-            auto rawData = dataRes.unwrap();
+    itb::ImportSettings getSettings() {
+        return {
+            .step = this->getStep(),
+            .visualScale = this->getScale(),
+            .tolerance = utils::numFromString<int>(m_toleranceInput->getString()).unwrapOr(5),
+            .merge = m_mergeToggle->isToggled(),
+            .strategy = m_strategy,
+            .metric = m_metric,
+            .paletteSize = std::clamp(utils::numFromString<int>(m_colorsInput->getString()).unwrapOr(0), 0, itb::kMaxPaletteSize),
+            .dither = m_dither,
+            .maxSpan = this->getMaxSpan(),
+            .sampling = m_smoothToggle->isToggled() ? itb::SampleMode::Average : itb::SampleMode::Point,
+            .layers = m_layerToggle->isToggled() ? itb::kDefaultLayers : 0,
+        };
+    }
 
-            int w, h, ch;
-            unsigned char* pixels = stbi_load_from_memory(rawData.data(), (int)rawData.size(), &w, &h, &ch, 4);
-            if (!pixels) return;
+    // Shows what is known right away and queues an exact count once the edits settle.
+    void updateStats() {
+        if (m_imageWidth == 0) return;
+        m_estimator->generation++;
+        this->showStats("Counting objects...", false);
+        this->unschedule(schedule_selector(ImportSettingsPopup::requestEstimate));
+        this->scheduleOnce(schedule_selector(ImportSettingsPopup::requestEstimate), kEstimateDelay);
+    }
 
-            std::vector<BlockData> blocks;
-            float effSize = 30.0f * visualScale;
-            int gW = (w + step - 1) / step;
-            int gH = (h + step - 1) / step;
-            float sX = -(gW * effSize) / 2.0f;
-            float sY = (gH * effSize) / 2.0f;
+    void showStats(std::string const& objects, bool laggy) {
+        m_infoLabel->setString(fmt::format("{}x{} ({}ch, {}-bit) | Step: {} | Span: {}\n{}",
+            m_imageWidth, m_imageHeight, m_imageChannels, m_imageBitDepth, this->getStep(), this->getMaxSpan(), objects).c_str());
+        m_infoLabel->setColor(laggy ? ccColor3B{255, 100, 100} : ccColor3B{255, 255, 255});
+    }
 
-            std::vector<bool> visited(gW * gH, false);
+    void showPreview(itb::Image const& image) {
+        if (image.width == 0 || image.height == 0) return;
+        auto texture = new CCTexture2D();
+        if (!texture->initWithData(image.pixels.data(), kCCTexture2DPixelFormat_RGBA8888, image.width, image.height,
+            CCSize(image.width, image.height))) {
+            texture->release();
+            return;
+        }
+        // Cells stay crisp squares at any zoom.
+        ccTexParams params = {GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE};
+        texture->setTexParameters(&params);
+
+        if (!m_previewSprite) {
+            m_previewSprite = CCSprite::createWithTexture(texture);
+            m_previewSprite->setPosition(m_previewCenter);
+            m_mainLayer->addChild(m_previewSprite);
+        }
+        else {
+            m_previewSprite->setTexture(texture);
+            m_previewSprite->setTextureRect({{0, 0}, texture->getContentSize()});
+        }
+        texture->release();
+        auto size = m_previewSprite->getContentSize();
+        m_previewSprite->setScale(kPreviewSize / std::max(size.width, size.height));
+    }
 
-            for (int gy = 0; gy < gH; gy++) {
-                for (int gx = 0; gx < gW; gx++) {
-                    if (visited[gy * gW + gx]) continue;
+    void showEstimate(size_t count, int generation) {
+        m_estimate = count;
+        m_estimateGeneration = generation;
+        bool laggy = count > itb::kSafeObjectCount;
+        this->showStats(fmt::format("{} Objects{}", count, laggy ? " (may lag the editor)" : ""), laggy);
+    }
 
-                    int px = gx * step, py = gy * step;
-                    if (px >= w || py >= h) continue;
+    void showEstimateFailed() {
+        this->showStats("Could not read image", true);
+    }
 
-                    int idx = (py * w + px) * 4;
-                    if (pixels[idx + 3] < 200) {
-                        visited[gy * gW + gx] = true;
+    void requestEstimate(float) {
+        auto estimator = m_estimator;
+        {
+            std::lock_guard lock(estimator->mutex);
+            estimator->pending = EstimateRequest{this->getSettings(), m_outlineToggle->isToggled()};
+            if (estimator->running) return;
+            estimator->running = true;
+        }
+        std::thread([estimator, handle = m_image]() {
+            while (true) {
+                EstimateRequest request;
+                int generation;
+                {
+                    std::lock_guard lock(estimator->mutex);
+                    if (!estimator->pending) {
+                        estimator->running = false;
+                        return;
+                    }
+                    request = *estimator->pending;
+                    estimator->pending.reset();
+                    generation = estimator->generation;
+                }
+                auto const& settings = request.settings;
+                // Merges poll the generation too, so an edit stops them mid-way instead of after.
+                itb::CancelToken cancel{ &estimator->generation, generation };
+                auto stale = [&] { return cancel.cancelled(); };
+                // A merge that returns nothing without being cancelled means the image couldn't be
+                // decoded; the label says so instead of staying on "Counting objects...".
+                auto fail = [&] {
+                    if (stale()) return;
+                    Loader::get()->queueInMainThread([estimator, generation]() {
+                        if (estimator->popup && estimator->generation == generation) estimator->popup->showEstimateFailed();
+                    });
+                };
+
+                // The preview goes first: whenever the import grid has to be downscaled for it, it's
+                // the cheaper merge. The decode and tables are cached on the handle.
+                if (estimator->previewSettings != settings) {
+                    auto preview = itb::mergePreview(*handle, settings, kPreviewCells, cancel);
+                    if (!preview) {
+                        fail();
                         continue;
                     }
-
-                    ccColor3B base = {pixels[idx], pixels[idx+1], pixels[idx+2]};
-                    int spX = 1, spY = 1;
-
-                    if (shouldMerge) {
-                        while (gx + spX < gW && spX < 5) {
-                            int nIdx = (py * w + (gx + spX) * step) * 4;
-                            if (visited[gy * gW + gx + spX] || pixels[nIdx+3] < 200 ||
-                                std::abs(pixels[nIdx]-base.r) > tolerance ||
-                                std::abs(pixels[nIdx+1]-base.g) > tolerance ||
-                                std::abs(pixels[nIdx+2]-base.b) > tolerance) break;
-                            spX++;
-                        }
-
-                        bool canY = true;
-                        while (gy + spY < gH && canY && spY < 5) {
-                            for (int k = 0; k < spX; k++) {
-                                int cIdx = ((gy + spY) * step * w + (gx + k) * step) * 4;
-                                if (visited[(gy+spY)*gW + gx+k] || pixels[cIdx+3] < 200 ||
-                                    std::abs(pixels[cIdx]-base.r) > tolerance ||
-                                    std::abs(pixels[cIdx+1]-base.g) > tolerance ||
-                                    std::abs(pixels[cIdx+2]-base.b) > tolerance) {
-                                    canY = false; break;
-                                }
-                            }
-                            if (canY) spY++;
+                    estimator->preview = std::move(*preview);
+                    estimator->previewSettings = settings;
+                }
+                if (stale()) continue;
+                auto image = itb::renderPreview(estimator->preview, kPreviewPixels, request.outlines);
+                Loader::get()->queueInMainThread([estimator, generation, image = std::move(image)]() {
+                    if (estimator->popup && estimator->generation == generation) estimator->popup->showPreview(image);
+                });
+
+                if (estimator->countSettings != settings) {
+                    if (stale()) continue;
+                    // A preview merged at full size is the import's own merge.
+                    if (estimator->preview.factor == 1) estimator->count = estimator->preview.rects.size();
+                    else {
+                        auto count = itb::countImportBlocks(*handle, settings, cancel);
+                        if (!count) {
+                            fail();
+                            continue;
                         }
+                        estimator->count = *count;
                     }
+                    estimator->countSettings = settings;
+                }
+                if (stale()) continue;
+                Loader::get()->queueInMainThread([estimator, generation, count = estimator->count]() {
+                    if (estimator->popup && estimator->generation == generation) estimator->popup->showEstimate(count, generation);
+                });
+            }
+        }).detach();
+    }
 
-                    for (int dy = 0; dy < spY; dy++)
-                        for (int dx = 0; dx < spX; dx++)
-                            visited[(gy + dy) * gW + (gx + dx)] = true;
+    float getScale() {
+        return utils::numFromString<float>(m_scaleInput->getString()).unwrapOr(0.1f);
+    }
 
-                    blocks.push_back({
-                        sX + (gx * effSize) + (effSize * spX / 2.0f),
-                        sY - (gy * effSize) - (effSize * spY / 2.0f),
-                        spX, spY, visualScale, rgbToGdhsv(base), base
-                    });
-                }
+    // Typed span, or the largest one the editor's scale limit allows at the current scale.
+    int getMaxSpan() {
+        int span = utils::numFromString<int>(m_spanInput->getString()).unwrapOr(0);
+        return span > 0 ? span : itb::calculateMaxSpan(this->getScale());
+    }
+
+    void onImport(CCObject*) {
+        if (m_isProcessing) return;
+        // Warns with the live count when it's current; otherwise imports as before.
+        if (m_estimateGeneration != m_estimator->generation || m_estimate <= (size_t)itb::kSafeObjectCount) {
+            this->startImport();
+            return;
+        }
+        createQuickPopup("Large Import",
+            fmt::format("This import adds <cr>{}</c> objects, which can make the editor lag. Import anyway?", m_estimate),
+            "Cancel", "Import",
+            [this](auto, bool confirmed) {
+                if (confirmed) this->startImport();
             }
-            stbi_image_free(pixels);
+        );
+    }
 
-            Loader::get()->queueInMainThread([blocks = std::move(blocks)]() {
+    void startImport() {
+        if (m_isProcessing.exchange(true)) return;
+        this->processImageBackground(this->getSettings());
+        this->onClose(nullptr);
+    }
+
+    void processImageBackground(itb::ImportSettings settings) {
+        std::thread([handle = m_image, settings]() {
+            auto result = itb::importImage(*handle, settings);
+            if (!result) return;
+            auto blocks = std::move(*result);
+
+            char const* strategy = settings.merge ? itb::mergeModeName(settings.strategy) : "No Merge";
+            Loader::get()->queueInMainThread([blocks = std::move(blocks), strategy]() {
                 auto editor = LevelEditorLayer::get();
                 if (!editor) return;
 
                 auto center = editor->m_objectLayer->convertToNodeSpace(CCDirector::get()->getWinSize() / 2);
 
-                std::ostringstream ss;
-                for (const auto& b : blocks) {
-                    ss << "1,211,2," << center.x + b.x << ",3," << center.y + b.y
-                       << ",41,1,67,1,43," << fmt::format("{}a{}a{}a1a1", b.hsv.h, b.hsv.s, b.hsv.v)
-                       << ",128," << b.visualScale * b.spanX << ",129," << b.visualScale * b.spanY << ";";
-                }
-
-                editor->createObjectsFromString(ss.str(), true, true);
-                Notification::create("Import Complete", NotificationIcon::Success)->show();
+                editor->createObjectsFromString(itb::buildLevelString(blocks, center.x, center.y), true, true);
+                Notification::create(fmt::format("Imported {} Objects ({})", blocks.size(), strategy), NotificationIcon::Success)->show();
             });
         }).detach();
     }